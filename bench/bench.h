@@ -0,0 +1,99 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Current monotonic time in nanoseconds.
+ */
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Pseudo-random number generator (xorshift64*).
+ *
+ * @param state generator state, must not be zero
+ */
+static inline uint64_t bench_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Randomly permute an array of 64-bit values.
+ *
+ * @param vals array to shuffle
+ * @param n number of values
+ * @param state generator state
+ */
+static inline void bench_shuffle(uint64_t *vals, size_t n, uint64_t *state) {
+  for (size_t i = n - 1; i > 0; --i) {
+    size_t j = bench_rand(state) % (i + 1);
+    uint64_t tmp = vals[i];
+    vals[i] = vals[j];
+    vals[j] = tmp;
+  }
+}
+
+/**
+ * Report a benchmark result in nanoseconds per operation.
+ *
+ * @param name name of the benchmark
+ * @param start start time
+ * @param ops number of operations done
+ */
+static inline void bench_report(const char *name, uint64_t start, size_t ops) {
+  uint64_t ns = bench_now() - start;
+  printf("%-40s %10zu ops %8.2f ns/op\n", name, ops, (double)ns / ops);
+}
+
+static inline int __bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Report percentiles of operation latencies in nanoseconds.
+ *
+ * Each sample includes the cost of reading the clock, which is the same for
+ * every benchmark.
+ *
+ * @param name name of the benchmark
+ * @param samples latencies of individual operations, sorted in place
+ * @param n number of samples
+ */
+static inline void bench_report_latency(const char *name, uint64_t *samples, size_t n) {
+  qsort(samples, n, sizeof(uint64_t), __bench_cmp_u64);
+  printf("%-40s p50 %6lu p99 %6lu p999 %6lu max %8lu ns\n", name,
+      (unsigned long)samples[n / 2], (unsigned long)samples[n * 99 / 100],
+      (unsigned long)samples[n * 999 / 1000], (unsigned long)samples[n - 1]);
+}
+
+#endif // BENCH_H_
@@ -0,0 +1,183 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "chtable.h"
+#include "htable.h"
+#include "rcu.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Number of entries present during the whole run */
+#define NUM_KEYS (1 << 20)
+/* Number of operations done by each thread */
+#define NUM_OPS (1 << 21)
+/* Number of entries each thread adds and removes again */
+#define NUM_OWN 1024
+/* Percentage of operations which modify the table */
+#define WRITE_PERCENT 10
+/* Number of operations between quiescent states of chtable workers */
+#define QS_INTERVAL 64
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+};
+
+struct worker {
+  pthread_t thread;
+  unsigned id;
+  struct item own[NUM_OWN];
+  size_t found;
+};
+
+static struct item *items;
+static struct htable htable;
+static pthread_mutex_t htable_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct chtable chtable;
+
+static void *htable_worker(void *arg) {
+  struct worker *w = arg;
+  uint64_t state = 0x9e3779b97f4a7c15ULL + w->id;
+  size_t head = 0, tail = 0;
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    uint64_t r = bench_rand(&state);
+    pthread_mutex_lock(&htable_lock);
+    if (r % 100 >= WRITE_PERCENT) {
+      w->found += htable_find(&htable, &items[r % NUM_KEYS].key, sizeof(uint64_t)) != NULL;
+    } else if (head - tail < NUM_OWN && (r & 1 || head == tail)) {
+      struct item *it = &w->own[head++ % NUM_OWN];
+      htable_add(&htable, &it->entry, &it->key, sizeof(uint64_t));
+    } else {
+      htable_del_entry(&htable, &w->own[tail++ % NUM_OWN].entry);
+    }
+    pthread_mutex_unlock(&htable_lock);
+  }
+  while (tail != head) {
+    pthread_mutex_lock(&htable_lock);
+    htable_del_entry(&htable, &w->own[tail++ % NUM_OWN].entry);
+    pthread_mutex_unlock(&htable_lock);
+  }
+  return NULL;
+}
+
+static void *chtable_worker(void *arg) {
+  struct worker *w = arg;
+  uint64_t state = 0x9e3779b97f4a7c15ULL + w->id;
+  // Entries before safe were removed before the last grace period
+  size_t head = 0, tail = 0, safe = 0;
+
+  rcu_register_thread();
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    uint64_t r = bench_rand(&state);
+    if (i % QS_INTERVAL == 0) {
+      rcu_quiescent_state();
+    }
+    if (r % 100 >= WRITE_PERCENT) {
+      w->found += chtable_find(&chtable, &items[r % NUM_KEYS].key, sizeof(uint64_t)) != NULL;
+    } else if (head - tail < NUM_OWN && (r & 1 || head == tail)) {
+      struct item *it;
+      // The slot may only be reused once lookups cannot see its old entry
+      if (head - safe >= NUM_OWN) {
+        size_t removed = tail;
+        synchronize_rcu();
+        safe = removed;
+      }
+      it = &w->own[head++ % NUM_OWN];
+      chtable_add(&chtable, &it->entry, &it->key, sizeof(uint64_t));
+    } else {
+      chtable_del_entry(&chtable, &w->own[tail++ % NUM_OWN].entry);
+    }
+  }
+  while (tail != head) {
+    chtable_del_entry(&chtable, &w->own[tail++ % NUM_OWN].entry);
+  }
+  rcu_unregister_thread();
+  return NULL;
+}
+
+static void run(const char *name, void *(*fn)(void *), unsigned nthreads) {
+  struct worker *workers = calloc(nthreads, sizeof(*workers));
+  size_t found = 0;
+  uint64_t start, ns;
+
+  assert(workers);
+  for (unsigned i = 0; i < nthreads; ++i) {
+    workers[i].id = i;
+    for (size_t j = 0; j < NUM_OWN; ++j) {
+      // Keys of table entries have the top bit clear
+      workers[i].own[j].key = (1ULL << 63) | ((uint64_t)i << 32) | j;
+    }
+  }
+
+  start = bench_now();
+  for (unsigned i = 0; i < nthreads; ++i) {
+    pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+  }
+  for (unsigned i = 0; i < nthreads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    found += workers[i].found;
+  }
+  ns = bench_now() - start;
+
+  printf("%-20s %3u threads %8.2f Mops/s (%zu found)\n", name, nthreads,
+      (double)NUM_OPS * nthreads * 1000 / ns, found);
+  free(workers);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned max_threads;
+  uint64_t state = 1;
+
+  if (argc > 1) {
+    max_threads = strtoul(argv[1], NULL, 0);
+  } else {
+    max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  items = calloc(NUM_KEYS, sizeof(*items));
+  assert(items);
+
+  htable_init_n(&htable, NUM_KEYS);
+  chtable_init_n(&chtable, NUM_KEYS, 0);
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    items[i].key = bench_rand(&state) >> 1;
+    htable_add(&htable, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    htable_del_entry(&htable, &items[i].entry);
+    chtable_add(&chtable, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  for (unsigned n = 1; n <= max_threads; n *= 2) {
+    run("chtable", chtable_worker, n);
+  }
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    chtable_del_entry(&chtable, &items[i].entry);
+    htable_add(&htable, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  for (unsigned n = 1; n <= max_threads; n *= 2) {
+    run("htable + mutex", htable_worker, n);
+  }
+
+  htable_destroy(&htable);
+  chtable_destroy(&chtable);
+  free(items);
+
+  return 0;
+}
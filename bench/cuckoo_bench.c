@@ -0,0 +1,108 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "cuckoo_htable.h"
+#include "htable.h"
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+  struct cuckoo_htable_entry centry;
+};
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 20;
+  struct item *items = calloc(n, sizeof(*items));
+  uint64_t *hits = malloc(sizeof(uint64_t) * n);
+  uint64_t *misses = malloc(sizeof(uint64_t) * n);
+  uint64_t *samples = malloc(sizeof(uint64_t) * n);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable table;
+  struct cuckoo_htable ctable;
+  size_t found = 0;
+  uint64_t start;
+
+  assert(items && hits && misses && samples);
+
+  htable_init(&table);
+  cuckoo_htable_init(&ctable);
+  for (size_t i = 0; i < n; ++i) {
+    // Odd keys are in the tables, even keys are not
+    items[i].key = hits[i] = bench_rand(&state) | 1;
+    misses[i] = bench_rand(&state) & ~1ULL;
+  }
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_report("htable_add", start, n);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    cuckoo_htable_add(&ctable, &items[i].centry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_report("cuckoo_htable_add", start, n);
+
+  printf("%zu entries, htable %zu buckets, cuckoo %zu buckets (load %.2f)\n", n, table.size, ctable.size,
+      (double)ctable.count / (ctable.size * CUCKOO_HTABLE_WAYS));
+
+  bench_shuffle(hits, n, &state);
+
+  for (size_t i = 0; i < n; ++i) {
+    start = bench_now();
+    found += htable_find(&table, &hits[i], sizeof(uint64_t)) != NULL;
+    samples[i] = bench_now() - start;
+  }
+  bench_report_latency("htable_find hit", samples, n);
+
+  for (size_t i = 0; i < n; ++i) {
+    start = bench_now();
+    found += cuckoo_htable_find(&ctable, &hits[i], sizeof(uint64_t)) != NULL;
+    samples[i] = bench_now() - start;
+  }
+  bench_report_latency("cuckoo_htable_find hit", samples, n);
+
+  for (size_t i = 0; i < n; ++i) {
+    start = bench_now();
+    found += htable_find(&table, &misses[i], sizeof(uint64_t)) != NULL;
+    samples[i] = bench_now() - start;
+  }
+  bench_report_latency("htable_find miss", samples, n);
+
+  for (size_t i = 0; i < n; ++i) {
+    start = bench_now();
+    found += cuckoo_htable_find(&ctable, &misses[i], sizeof(uint64_t)) != NULL;
+    samples[i] = bench_now() - start;
+  }
+  bench_report_latency("cuckoo_htable_find miss", samples, n);
+
+  if (found != 2 * n) {
+    fprintf(stderr, "unexpected number of entries found: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  htable_destroy(&table);
+  cuckoo_htable_destroy(&ctable);
+  free(items);
+  free(hits);
+  free(misses);
+  free(samples);
+
+  return 0;
+}
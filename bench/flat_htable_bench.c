@@ -0,0 +1,153 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Allow filling the open addressing tables up to 15/16 so that 90% load can be measured */
+#define FLAT_HTABLE_MAX_LOAD 15
+#define ROBIN_HTABLE_MAX_LOAD 15
+
+#include "bench.h"
+#include "flat_htable.h"
+#include "htable.h"
+#include "robin_htable.h"
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+  struct flat_htable_entry fentry;
+  struct robin_htable_entry rentry;
+};
+
+static void bench_load(size_t size, unsigned load) {
+  size_t n = size * load / 100;
+  struct item *items = calloc(n, sizeof(*items));
+  uint64_t *hits = malloc(sizeof(uint64_t) * n);
+  uint64_t *misses = malloc(sizeof(uint64_t) * n);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable htable;
+  struct flat_htable ftable;
+  struct robin_htable rtable;
+  size_t found = 0;
+  uint64_t start;
+  char name[64];
+
+  assert(items && hits && misses);
+
+  htable_init_n(&htable, size);
+  flat_htable_init_n(&ftable, size);
+  robin_htable_init_n(&rtable, size);
+
+  for (size_t i = 0; i < n; ++i) {
+    // Odd keys are in the tables, even keys are not
+    items[i].key = hits[i] = bench_rand(&state) | 1;
+    misses[i] = bench_rand(&state) & ~1ULL;
+    htable_add(&htable, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+    flat_htable_add(&ftable, &items[i].fentry, &items[i].key, sizeof(uint64_t));
+    robin_htable_add(&rtable, &items[i].rentry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_shuffle(hits, n, &state);
+
+  printf("load %u%% (%zu entries, %zu buckets, %zu slots)\n", load, n, htable.size, ftable.size);
+
+  snprintf(name, sizeof(name), "htable_find hit");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_find(&htable, &hits[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "flat_htable_find hit");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += flat_htable_find(&ftable, &hits[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "robin_htable_find hit");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += robin_htable_find(&rtable, &hits[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "htable_find miss");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_find(&htable, &misses[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "flat_htable_find miss");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += flat_htable_find(&ftable, &misses[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "robin_htable_find miss");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += robin_htable_find(&rtable, &misses[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  // Replace every entry once, leaving deleted slots behind in the flat table
+  for (size_t i = 0; i < n; ++i) {
+    flat_htable_del_entry(&ftable, &items[i].fentry);
+    robin_htable_del_entry(&rtable, &items[i].rentry);
+    items[i].key = misses[i] | 1;
+    flat_htable_add(&ftable, &items[i].fentry, &items[i].key, sizeof(uint64_t));
+    robin_htable_add(&rtable, &items[i].rentry, &items[i].key, sizeof(uint64_t));
+  }
+
+  snprintf(name, sizeof(name), "flat_htable_find miss after churn");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += flat_htable_find(&ftable, &misses[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  snprintf(name, sizeof(name), "robin_htable_find miss after churn");
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += robin_htable_find(&rtable, &misses[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report(name, start, n);
+
+  if (found != 3 * n) {
+    fprintf(stderr, "unexpected number of entries found: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  htable_destroy(&htable);
+  flat_htable_destroy(&ftable);
+  robin_htable_destroy(&rtable);
+  free(items);
+  free(hits);
+  free(misses);
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 20;
+  static const unsigned loads[] = { 50, 75, 90 };
+
+  size = roundup_pow_of_two(size);
+  for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); ++i) {
+    bench_load(size, loads[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "htable.h"
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+};
+
+/**
+ * Look up all keys in groups of given size, one key at a time.
+ */
+static size_t bench_single(struct htable *table, const void **keys, const size_t *lens, size_t n, size_t batch) {
+  size_t found = 0;
+
+  for (size_t i = 0; i < n; i += batch) {
+    for (size_t j = i; j < min_t(size_t, i + batch, n); ++j) {
+      found += htable_find(table, keys[j], lens[j]) != NULL;
+    }
+  }
+  return found;
+}
+
+/**
+ * Look up all keys in groups of given size using batched lookups.
+ */
+static size_t bench_batch(struct htable *table, const void **keys, const size_t *lens, size_t n, size_t batch,
+    struct htable_entry **out) {
+  size_t found = 0;
+
+  for (size_t i = 0; i < n; i += batch) {
+    found += htable_find_batch(table, &keys[i], &lens[i], min_t(size_t, batch, n - i), out);
+  }
+  return found;
+}
+
+int main(int argc, char *argv[]) {
+  // Large enough to exceed last level cache of common processors
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 22;
+  static const size_t batches[] = { 16, 64, 256 };
+  struct item *items = calloc(n, sizeof(*items));
+  uint64_t *hits = malloc(sizeof(uint64_t) * n);
+  uint64_t *misses = malloc(sizeof(uint64_t) * n);
+  const void **keys = malloc(sizeof(void *) * n);
+  size_t *lens = malloc(sizeof(size_t) * n);
+  struct htable_entry **out = malloc(sizeof(struct htable_entry *) * batches[2]);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable table;
+  size_t found = 0;
+  uint64_t start;
+  char name[64];
+
+  assert(items && hits && misses && keys && lens && out);
+
+  htable_init_n(&table, n);
+  for (size_t i = 0; i < n; ++i) {
+    // Odd keys are in the table, even keys are not
+    items[i].key = hits[i] = bench_rand(&state) | 1;
+    misses[i] = bench_rand(&state) & ~1ULL;
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+    lens[i] = sizeof(uint64_t);
+  }
+  bench_shuffle(hits, n, &state);
+
+  printf("%zu entries, %zu buckets, %d keys overlapped\n", n, table.size, HASH_BATCH_SIZE);
+
+  for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = &hits[i];
+    }
+
+    snprintf(name, sizeof(name), "htable_find hit x%zu", batches[b]);
+    start = bench_now();
+    found += bench_single(&table, keys, lens, n, batches[b]);
+    bench_report(name, start, n);
+
+    snprintf(name, sizeof(name), "htable_find_batch hit x%zu", batches[b]);
+    start = bench_now();
+    found += bench_batch(&table, keys, lens, n, batches[b], out);
+    bench_report(name, start, n);
+
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = &misses[i];
+    }
+
+    snprintf(name, sizeof(name), "htable_find miss x%zu", batches[b]);
+    start = bench_now();
+    found += bench_single(&table, keys, lens, n, batches[b]);
+    bench_report(name, start, n);
+
+    snprintf(name, sizeof(name), "htable_find_batch miss x%zu", batches[b]);
+    start = bench_now();
+    found += bench_batch(&table, keys, lens, n, batches[b], out);
+    bench_report(name, start, n);
+  }
+
+  if (found != 2 * n * (sizeof(batches) / sizeof(batches[0]))) {
+    fprintf(stderr, "unexpected number of entries found: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  htable_destroy(&table);
+  free(items);
+  free(hits);
+  free(misses);
+  free(keys);
+  free(lens);
+  free(out);
+
+  return 0;
+}
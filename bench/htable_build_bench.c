@@ -0,0 +1,100 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "htable.h"
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+};
+
+/**
+ * Visit all entries of the table.
+ */
+static size_t bench_scan(struct htable *table) {
+  struct htable_entry *pos;
+  uint64_t sum = 0;
+  size_t n = 0;
+
+  htable_for_each(pos, table) {
+    sum += *(uint64_t *)pos->key;
+    n++;
+  }
+  return n + (sum == 0);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 22;
+  struct item *items = calloc(n, sizeof(*items));
+  struct htable_entry **entries = malloc(sizeof(struct htable_entry *) * n);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable table;
+  size_t found = 0;
+  uint64_t start;
+
+  assert(items && entries);
+
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = bench_rand(&state);
+    entries[i] = &items[i].hentry;
+  }
+
+  htable_init(&table);
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_report("htable_add", start, n);
+
+  start = bench_now();
+  found += bench_scan(&table);
+  bench_report("htable_for_each after htable_add", start, n);
+  htable_destroy(&table);
+
+  htable_init(&table);
+  start = bench_now();
+  htable_reserve(&table, n);
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_report("htable_reserve + htable_add", start, n);
+  htable_destroy(&table);
+
+  htable_init(&table);
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    INIT_HTABLE_ENTRY(&items[i].hentry, &items[i].key, sizeof(uint64_t));
+  }
+  htable_build(&table, entries, n);
+  bench_report("htable_build", start, n);
+
+  start = bench_now();
+  found += bench_scan(&table);
+  bench_report("htable_for_each after htable_build", start, n);
+  htable_destroy(&table);
+
+  if (found != 2 * n) {
+    fprintf(stderr, "unexpected number of entries found: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  free(items);
+  free(entries);
+
+  return 0;
+}
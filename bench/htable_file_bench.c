@@ -0,0 +1,98 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+#include "htable_file.h"
+
+#include <unistd.h>
+
+struct item {
+  uint64_t key;
+  uint64_t value;
+  struct htable_entry entry;
+};
+
+static const void *item_value(const struct htable_entry *entry, size_t *len, void *arg) {
+  struct item *it = hash_entry(entry, struct item, entry);
+
+  *len = sizeof(it->value);
+  return &it->value;
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 20;
+  const char *path = argc > 2 ? argv[2] : "htable_file_bench.tmp";
+  struct item *items = calloc(n, sizeof(*items));
+  uint64_t *keys = malloc(sizeof(uint64_t) * n);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable table;
+  struct htable_file file;
+  size_t found = 0;
+  uint64_t start;
+
+  assert(items && keys);
+
+  htable_init(&table);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = items[i].key = bench_rand(&state);
+    items[i].value = i;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+
+  start = bench_now();
+  if (htable_file_build(&table, path, item_value, NULL)) {
+    perror("htable_file_build");
+    exit(EXIT_FAILURE);
+  }
+  bench_report("htable_file_build", start, 1);
+
+  start = bench_now();
+  if (htable_file_open(&file, path)) {
+    perror("htable_file_open");
+    exit(EXIT_FAILURE);
+  }
+  bench_report("htable_file_open", start, 1);
+
+  // Look the keys up in a different order than they were added
+  bench_shuffle(keys, n, &state);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_file_find(&file, &keys[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report("htable_file_find hit", start, n);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_find(&table, &keys[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report("htable_find hit", start, n);
+
+  if (found != 2 * n) {
+    fprintf(stderr, "unexpected number of keys found: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  htable_file_close(&file);
+  unlink(path);
+  htable_destroy(&table);
+  free(keys);
+  free(items);
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+#include "htable.h"
+#include "rcu.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Number of entries present during the whole run */
+#define NUM_KEYS (1 << 16)
+/* Number of lookups done by each reader */
+#define NUM_OPS (1 << 22)
+/* Number of entries the writer adds and then removes again, resizing the table */
+#define NUM_CHURN (1 << 17)
+/* Number of lookups between quiescent states of readers */
+#define QS_INTERVAL 64
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+};
+
+struct ops {
+  const char *name;
+  void *(*reader)(void *);
+  void (*add)(struct item *);
+  void (*del)(struct item *);
+  /** Called before removed entries are added again */
+  void (*reuse)(void);
+};
+
+struct reader {
+  pthread_t thread;
+  unsigned id;
+  size_t found;
+};
+
+static struct item *items;
+static struct item *churn;
+static struct htable table;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Number of readers which have done all their lookups */
+static atomic_uint finished;
+
+static void *rcu_reader(void *arg) {
+  struct reader *r = arg;
+  uint64_t state = 0x9e3779b97f4a7c15ULL + r->id;
+
+  rcu_register_thread();
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    if (i % QS_INTERVAL == 0) {
+      rcu_quiescent_state();
+    }
+    r->found += htable_find_rcu(&table, &items[bench_rand(&state) % NUM_KEYS].key, sizeof(uint64_t)) != NULL;
+  }
+  rcu_unregister_thread();
+  atomic_fetch_add(&finished, 1);
+  return NULL;
+}
+
+static void rcu_add(struct item *it) {
+  htable_add_rcu(&table, &it->entry, &it->key, sizeof(uint64_t));
+}
+
+static void rcu_del(struct item *it) {
+  htable_del_key_rcu(&table, &it->key, sizeof(uint64_t));
+}
+
+static void *rwlock_reader(void *arg) {
+  struct reader *r = arg;
+  uint64_t state = 0x9e3779b97f4a7c15ULL + r->id;
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    pthread_rwlock_rdlock(&table_lock);
+    r->found += htable_find(&table, &items[bench_rand(&state) % NUM_KEYS].key, sizeof(uint64_t)) != NULL;
+    pthread_rwlock_unlock(&table_lock);
+  }
+  atomic_fetch_add(&finished, 1);
+  return NULL;
+}
+
+static void rwlock_add(struct item *it) {
+  pthread_rwlock_wrlock(&table_lock);
+  htable_add(&table, &it->entry, &it->key, sizeof(uint64_t));
+  pthread_rwlock_unlock(&table_lock);
+}
+
+static void rwlock_del(struct item *it) {
+  pthread_rwlock_wrlock(&table_lock);
+  htable_del_key(&table, &it->key, sizeof(uint64_t));
+  pthread_rwlock_unlock(&table_lock);
+}
+
+static void rwlock_reuse(void) {
+}
+
+static void run(const struct ops *ops, unsigned nreaders) {
+  struct reader *readers = calloc(nreaders, sizeof(*readers));
+  size_t found = 0, writes = 0;
+  uint64_t start, ns;
+
+  assert(readers);
+  atomic_store(&finished, 0);
+
+  start = bench_now();
+  for (unsigned i = 0; i < nreaders; ++i) {
+    readers[i].id = i;
+    pthread_create(&readers[i].thread, NULL, ops->reader, &readers[i]);
+  }
+  // Grow the table and shrink it again until all lookups are done
+  while (atomic_load(&finished) < nreaders) {
+    size_t n = 0;
+
+    while (n < NUM_CHURN && atomic_load(&finished) < nreaders) {
+      ops->add(&churn[n++]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      ops->del(&churn[i]);
+    }
+    ops->reuse();
+    writes += 2 * n;
+  }
+  ns = bench_now() - start;
+
+  for (unsigned i = 0; i < nreaders; ++i) {
+    pthread_join(readers[i].thread, NULL);
+    found += readers[i].found;
+  }
+  printf("%-16s %3u readers %8.2f Mlookups/s %8.2f Mupdates/s (%zu found)\n", ops->name, nreaders,
+      (double)NUM_OPS * nreaders * 1000 / ns, (double)writes * 1000 / ns, found);
+  free(readers);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct ops rcu_ops = {"htable_find_rcu", rcu_reader, rcu_add, rcu_del, synchronize_rcu};
+  static const struct ops rwlock_ops = {"htable + rwlock", rwlock_reader, rwlock_add, rwlock_del, rwlock_reuse};
+  unsigned max_readers;
+  uint64_t state = 1;
+
+  if (argc > 1) {
+    max_readers = strtoul(argv[1], NULL, 0);
+  } else {
+    max_readers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  items = calloc(NUM_KEYS, sizeof(*items));
+  churn = calloc(NUM_CHURN, sizeof(*churn));
+  assert(items && churn);
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    // Keys of churned entries have the top bit set
+    items[i].key = bench_rand(&state) >> 1;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  for (size_t i = 0; i < NUM_CHURN; ++i) {
+    churn[i].key = (1ULL << 63) | i;
+  }
+
+  for (unsigned n = 1; n <= max_readers; n *= 2) {
+    run(&rcu_ops, n);
+  }
+  for (unsigned n = 1; n <= max_readers; n *= 2) {
+    run(&rwlock_ops, n);
+  }
+
+  htable_destroy(&table);
+  free(churn);
+  free(items);
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+#include "htable.h"
+#include "ihtable.h"
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+  struct ihtable_entry ientry;
+};
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 20;
+  struct item *items = calloc(n, sizeof(*items));
+  uint64_t *keys = malloc(sizeof(uint64_t) * n);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct htable htable;
+  struct ihtable ihtable;
+  size_t found = 0, missed = 0;
+  uint64_t start;
+
+  assert(items && keys);
+
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = items[i].key = bench_rand(&state);
+  }
+
+  htable_init(&htable);
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&htable, &items[i].hentry, &items[i].key, sizeof(uint64_t));
+  }
+  bench_report("htable_add", start, n);
+
+  ihtable_init(&ihtable);
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    ihtable_add(&ihtable, &items[i].ientry, items[i].key);
+  }
+  bench_report("ihtable_add", start, n);
+
+  // Look the keys up in a different order than they were added
+  bench_shuffle(keys, n, &state);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_find(&htable, &keys[i], sizeof(uint64_t)) != NULL;
+  }
+  bench_report("htable_find hit", start, n);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    found += ihtable_find(&ihtable, keys[i]) != NULL;
+  }
+  bench_report("ihtable_find hit", start, n);
+
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = bench_rand(&state);
+  }
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    missed += htable_find(&htable, &keys[i], sizeof(uint64_t)) == NULL;
+  }
+  bench_report("htable_find miss", start, n);
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    missed += ihtable_find(&ihtable, keys[i]) == NULL;
+  }
+  bench_report("ihtable_find miss", start, n);
+
+  if (found != 2 * n || missed != 2 * n) {
+    fprintf(stderr, "unexpected number of keys found: %zu, missed: %zu\n", found, missed);
+    exit(EXIT_FAILURE);
+  }
+
+  htable_destroy(&htable);
+  ihtable_destroy(&ihtable);
+  free(keys);
+  free(items);
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+#include "rbtree.h"
+
+#define CMP(a, b) (((a) < (b)) - ((a) > (b)))
+
+struct item {
+  uint64_t key;
+  struct rb_node node;
+};
+
+/**
+ * Sum keys of the tree in order, checking that they are sorted.
+ */
+static size_t bench_walk(struct rb_root *root) {
+  struct rb_node *pos;
+  uint64_t prev = 0;
+  size_t n = 0;
+
+  rb_for_each(pos, root) {
+    uint64_t key = rb_entry(pos, struct item, node)->key;
+
+    if (n++ && key <= prev) {
+      fprintf(stderr, "tree out of order\n");
+      exit(EXIT_FAILURE);
+    }
+    prev = key;
+  }
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 23;
+  struct item *items = calloc(n, sizeof(*items));
+  struct rb_node **nodes = malloc(sizeof(struct rb_node *) * n);
+  struct rb_root root = RB_ROOT;
+  size_t found = 0;
+  uint64_t start;
+
+  assert(items && nodes);
+
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = i;
+    nodes[i] = &items[i].node;
+  }
+
+  start = bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert(&root, struct item, node, key, &items[i].node, CMP);
+  }
+  bench_report("rb_insert sorted", start, n);
+  found += bench_walk(&root);
+
+  root = RB_ROOT;
+  start = bench_now();
+  rb_build_sorted(&root, nodes, n);
+  bench_report("rb_build_sorted", start, n);
+  found += bench_walk(&root);
+
+  if (found != 2 * n) {
+    fprintf(stderr, "unexpected number of nodes: %zu\n", found);
+    exit(EXIT_FAILURE);
+  }
+
+  free(nodes);
+  free(items);
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "sharded_htable.h"
+
+#include <pthread.h>
+
+/* Number of distinct keys */
+#define NUM_KEYS (1 << 18)
+/* Number of keys counted by all threads together */
+#define NUM_OPS (1 << 23)
+/* Maximum number of threads */
+#define MAX_THREADS 8
+
+/* Aggregate of one key */
+struct group {
+  uint64_t key;
+  size_t count;
+  struct htable_entry entry;
+};
+
+struct worker {
+  pthread_t thread;
+  struct htable *shard;
+  const uint64_t *keys;
+  size_t n;
+  struct group *groups;
+};
+
+static uint64_t *keys;
+
+/**
+ * Count keys in a table, the way each thread counts them in its shard.
+ */
+static void count_keys(struct htable *table, const uint64_t *keys, size_t n, struct group *groups) {
+  size_t ngroups = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    struct group *g = hash_find_entry(table, &keys[i], sizeof(uint64_t), struct group, entry);
+    if (!g) {
+      g = &groups[ngroups++];
+      g->key = keys[i];
+      g->count = 0;
+      htable_add(table, &g->entry, &g->key, sizeof(uint64_t));
+    }
+    g->count++;
+  }
+}
+
+static void *count_worker(void *arg) {
+  struct worker *w = arg;
+
+  count_keys(w->shard, w->keys, w->n, w->groups);
+  return NULL;
+}
+
+static void merge_counts(struct htable_entry *dst, struct htable_entry *src, void *arg) {
+  (void)arg;
+  hash_entry(dst, struct group, entry)->count += hash_entry(src, struct group, entry)->count;
+}
+
+static void bench_shards(size_t nthreads) {
+  struct worker workers[MAX_THREADS];
+  struct sharded_htable table;
+  struct group *g;
+  struct htable_entry *pos;
+  size_t total = 0;
+  uint64_t start;
+  char name[64];
+
+  sharded_htable_init(&table, nthreads, nthreads * 4, NUM_KEYS, 0);
+  for (size_t i = 0; i < nthreads; ++i) {
+    workers[i].shard = sharded_htable_shard(&table, i);
+    workers[i].keys = &keys[i * (NUM_OPS / nthreads)];
+    workers[i].n = NUM_OPS / nthreads;
+    workers[i].groups = malloc(sizeof(struct group) * NUM_KEYS);
+    assert(workers[i].groups);
+  }
+
+  start = bench_now();
+  for (size_t i = 0; i < nthreads; ++i) {
+    pthread_create(&workers[i].thread, NULL, count_worker, &workers[i]);
+  }
+  for (size_t i = 0; i < nthreads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  snprintf(name, sizeof(name), "count by key, %zu threads", nthreads);
+  bench_report(name, start, NUM_OPS);
+
+  start = bench_now();
+  sharded_htable_merge(&table, nthreads, merge_counts, NULL);
+  snprintf(name, sizeof(name), "merge, %zu threads", nthreads);
+  bench_report(name, start, sharded_htable_count(&table));
+
+  sharded_htable_for_each_entry(g, pos, &table, entry) {
+    total += g->count;
+  }
+  if (total != NUM_OPS || sharded_htable_count(&table) > NUM_KEYS) {
+    fprintf(stderr, "unexpected counts: %zu total, %zu keys\n", total, sharded_htable_count(&table));
+    exit(EXIT_FAILURE);
+  }
+
+  sharded_htable_destroy(&table);
+  for (size_t i = 0; i < nthreads; ++i) {
+    free(workers[i].groups);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct group *groups;
+  struct htable table;
+  uint64_t start;
+
+  nthreads = min_t(size_t, nthreads, MAX_THREADS);
+  keys = malloc(sizeof(uint64_t) * NUM_OPS);
+  groups = malloc(sizeof(struct group) * NUM_KEYS);
+  assert(keys && groups);
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    keys[i] = bench_rand(&state) % NUM_KEYS;
+  }
+
+  htable_init_n(&table, NUM_KEYS);
+  start = bench_now();
+  count_keys(&table, keys, NUM_OPS, groups);
+  bench_report("count by key, single htable", start, NUM_OPS);
+  htable_destroy(&table);
+
+  for (size_t n = 1; n <= nthreads; n *= 2) {
+    bench_shards(n);
+  }
+
+  free(groups);
+  free(keys);
+
+  return 0;
+}
@@ -30,6 +30,12 @@
  * @{
  */
 
+// Use __atomic builtins of compilers which provide them
+#if !defined(__GNUC_ATOMICS) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))))
+#define __GNUC_ATOMICS
+#endif
+
 #define _Atomic(T) struct { volatile T __val; }
 
 // Initialization
@@ -208,7 +214,7 @@ typedef atomic_bool atomic_flag;
 #define atomic_flag_clear_explicit(object, order) \
   atomic_store_explicit(object, 0, order)
 #define atomic_flag_test_and_set_explicit(object, order) \
-  atomic_compare_exchange_strong_explicit(object, 0, 1, order, order)
+  atomic_exchange_explicit(object, 1, order)
 
 #define atomic_flag_clear(object) \
   atomic_flag_clear_explicit(object, memory_order_seq_cst)
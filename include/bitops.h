@@ -147,7 +147,8 @@ static inline unsigned long __ffs64(uint64_t word) {
  *
  * @param x word to search.
  */
-static inline int fls(int x) {
+static inline int fls(int v) {
+    unsigned int x = v;
     int r = 32;
 
     if (!x)
@@ -184,9 +185,10 @@ static inline int fls64(uint64_t x) {
 }
 #elif __WORDSIZE == 64
 static inline int fls64(uint64_t x) {
-    if (x == 0)
-        return 0;
-    return __ffs(x) + 1;
+    uint32_t h = x >> 32;
+    if (h)
+        return fls(h) + 32;
+    return fls(x);
 }
 #endif
 
@@ -267,6 +269,36 @@ static inline uint8_t ror8(uint8_t word, unsigned int shift) {
     return (word >> shift) | (word << (8 - shift));
 }
 
+/**
+ * Reverse the order of bits in a 32-bit value.
+ * @param x value to reverse
+ */
+static inline uint32_t bitrev32(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    return __builtin_bswap32(x);
+}
+
+/**
+ * Reverse the order of bits in a 64-bit value.
+ * @param x value to reverse
+ */
+static inline uint64_t bitrev64(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+    return __builtin_bswap64(x);
+}
+
+/**
+ * Reverse the order of bits in a value of type unsigned long.
+ * @param x value to reverse
+ */
+static inline unsigned long bitrev_long(unsigned long x) {
+    return sizeof(x) == 4 ? bitrev32(x) : bitrev64(x);
+}
+
 #define for_each_set_bit(bit, addr, size) \
     for ((bit) = find_first_bit((addr), (size)); \
          (bit) < (size); \
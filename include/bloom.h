@@ -0,0 +1,265 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "bitops.h"
+#include "compiler.h"
+#include "hash.h"
+#include "kernel.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Blocked Bloom filter over 32-bit hash values.
+ *
+ * All bits of a key are set within a single block of 64 bits, so testing a
+ * key touches one cache line. The bits are derived from the key hash, which
+ * is mixed first so that they are independent of the hash bits used to pick
+ * a hash table bucket. The counting variant keeps an 8-bit counter instead
+ * of each bit, so keys can be removed again; saturated counters stay set.
+ */
+
+/** Number of bits in a block */
+#define BLOOM_BLOCK_ORDER 6
+/** Number of bits set for each key */
+#define BLOOM_NUM_HASHES 4
+/** Value at which counters saturate */
+#define BLOOM_COUNTER_MAX UINT8_MAX
+
+/** Bloom filter */
+struct bloom {
+  /** Bit vector, or vector of counters for counting filter */
+  uint8_t *bits;
+  /** Filter has 2^order bits */
+  unsigned order;
+  /** Keep counter for each bit */
+  bool counting;
+};
+
+/**
+ * Initialize new Bloom filter.
+ *
+ * @param bloom Bloom filter
+ * @param order the filter has 2^order bits, at least one block
+ * @param counting whether to keep counters so keys can be removed
+ */
+static inline int bloom_init(struct bloom *bloom, unsigned order, bool counting) {
+  size_t size;
+
+  bloom->order = order = clamp_t(unsigned, order, BLOOM_BLOCK_ORDER, 32);
+  bloom->counting = counting;
+
+  size = counting ? (1ULL << order) : (1ULL << order) / BITS_PER_BYTE;
+  bloom->bits = (uint8_t *)calloc(size, 1);
+
+  return bloom->bits ? 0 : -1;
+}
+
+/**
+ * Destroy Bloom filter.
+ *
+ * @param bloom Bloom filter
+ */
+static inline void bloom_destroy(struct bloom *bloom) {
+  free(bloom->bits);
+  bloom->bits = NULL;
+}
+
+/**
+ * Get the number of bits of the filter.
+ */
+#define bloom_size(bloom) (1ULL << (bloom)->order)
+
+/**
+ * Get index of the first bit of the block for given hash.
+ */
+static inline size_t __bloom_block(const struct bloom *bloom, uint32_t hash) {
+  if (bloom->order == BLOOM_BLOCK_ORDER) {
+    return 0;
+  }
+  return (size_t)hash_32(hash, bloom->order - BLOOM_BLOCK_ORDER) << BLOOM_BLOCK_ORDER;
+}
+
+/**
+ * Get bits within the block for given hash.
+ *
+ * The hash is put through the MurmurHash3 finalizer, so that the bits are
+ * independent of the multiplicative hash selecting the block.
+ */
+static inline uint64_t __bloom_mask(uint32_t hash) {
+  uint32_t h = hash;
+  uint64_t mask = 0;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  for (int i = 0; i < BLOOM_NUM_HASHES; ++i) {
+    mask |= 1ULL << ((h >> (32 - BLOOM_BLOCK_ORDER * (i + 1))) & ((1 << BLOOM_BLOCK_ORDER) - 1));
+  }
+  return mask;
+}
+
+/**
+ * Add hash value to Bloom filter.
+ *
+ * @param bloom Bloom filter
+ * @param hash hash of the added key
+ */
+static inline void bloom_add(struct bloom *bloom, uint32_t hash) {
+  size_t block = __bloom_block(bloom, hash);
+  uint64_t mask = __bloom_mask(hash);
+
+  if (bloom->counting) {
+    uint8_t *counters = &bloom->bits[block];
+    for (; mask; mask &= mask - 1) {
+      uint8_t *c = &counters[__builtin_ctzll(mask)];
+      if (*c < BLOOM_COUNTER_MAX) {
+        (*c)++;
+      }
+    }
+  } else {
+    uint64_t word;
+    memcpy(&word, &bloom->bits[block / BITS_PER_BYTE], sizeof(word));
+    word |= mask;
+    memcpy(&bloom->bits[block / BITS_PER_BYTE], &word, sizeof(word));
+  }
+}
+
+/**
+ * Remove hash value from counting Bloom filter.
+ *
+ * Does nothing for filters without counters.
+ *
+ * @param bloom Bloom filter
+ * @param hash hash of the removed key
+ */
+static inline void bloom_del(struct bloom *bloom, uint32_t hash) {
+  if (bloom->counting) {
+    uint8_t *counters = &bloom->bits[__bloom_block(bloom, hash)];
+    for (uint64_t mask = __bloom_mask(hash); mask; mask &= mask - 1) {
+      uint8_t *c = &counters[__builtin_ctzll(mask)];
+      if (*c > 0 && *c < BLOOM_COUNTER_MAX) {
+        (*c)--;
+      }
+    }
+  }
+}
+
+/**
+ * Prefetch the block of Bloom filter for given hash value.
+ *
+ * @param bloom Bloom filter
+ * @param hash hash of the key to be tested
+ */
+static inline void bloom_prefetch(const struct bloom *bloom, uint32_t hash) {
+  size_t block = __bloom_block(bloom, hash);
+
+  prefetch(&bloom->bits[bloom->counting ? block : block / BITS_PER_BYTE]);
+}
+
+/**
+ * Test whether hash value may have been added to Bloom filter.
+ *
+ * @param bloom Bloom filter
+ * @param hash hash of the key to look for
+ * @return false if the key is definitely not present, true otherwise
+ */
+static inline bool bloom_test(const struct bloom *bloom, uint32_t hash) {
+  size_t block = __bloom_block(bloom, hash);
+  uint64_t mask = __bloom_mask(hash);
+
+  if (bloom->counting) {
+    const uint8_t *counters = &bloom->bits[block];
+    for (; mask; mask &= mask - 1) {
+      if (!counters[__builtin_ctzll(mask)]) {
+        return false;
+      }
+    }
+    return true;
+  } else {
+    uint64_t word;
+    memcpy(&word, &bloom->bits[block / BITS_PER_BYTE], sizeof(word));
+    return (word & mask) == mask;
+  }
+}
+
+/**
+ * Count set bits within given block.
+ */
+static inline unsigned __bloom_block_weight(const struct bloom *bloom, size_t block) {
+  unsigned weight = 0;
+
+  if (bloom->counting) {
+    for (size_t i = 0; i < (1 << BLOOM_BLOCK_ORDER); ++i) {
+      weight += bloom->bits[block + i] != 0;
+    }
+  } else {
+    uint64_t word;
+    memcpy(&word, &bloom->bits[block / BITS_PER_BYTE], sizeof(word));
+    weight = __builtin_popcountll(word);
+  }
+  return weight;
+}
+
+/**
+ * Get the fraction of bits set in Bloom filter.
+ *
+ * @param bloom Bloom filter
+ */
+static inline double bloom_saturation(const struct bloom *bloom) {
+  size_t weight = 0;
+
+  for (size_t block = 0; block < bloom_size(bloom); block += 1 << BLOOM_BLOCK_ORDER) {
+    weight += __bloom_block_weight(bloom, block);
+  }
+  return (double)weight / bloom_size(bloom);
+}
+
+/**
+ * Estimate false positive rate of Bloom filter from the bits set.
+ *
+ * A key absent from the filter is reported present when all of its bits are
+ * set in its block, so the rate is the average over blocks of the fraction
+ * of bits set in the block raised to the number of bits per key.
+ *
+ * @param bloom Bloom filter
+ */
+static inline double bloom_fp_rate(const struct bloom *bloom) {
+  size_t nblocks = bloom_size(bloom) >> BLOOM_BLOCK_ORDER;
+  double rate = 0;
+
+  for (size_t block = 0; block < bloom_size(bloom); block += 1 << BLOOM_BLOCK_ORDER) {
+    double fill = (double)__bloom_block_weight(bloom, block) / (1 << BLOOM_BLOCK_ORDER);
+    double p = 1;
+
+    for (int i = 0; i < BLOOM_NUM_HASHES; ++i) {
+      p *= fill;
+    }
+    rate += p;
+  }
+  return rate / nblocks;
+}
+
+#endif // BLOOM_H_
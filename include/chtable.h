@@ -0,0 +1,348 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHTABLE_H_
+#define CHTABLE_H_
+
+#include "htable.h"
+#include "spinlock.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Concurrent hash table.
+ *
+ * Buckets are guarded by an array of striped sequence locks: a key always
+ * maps to stripe (hash % number of stripes), whatever the number of buckets,
+ * so writers to different stripes never contend. Lookups take no lock and
+ * write no shared memory; they retry when a writer modified the stripe
+ * during the lookup.
+ *
+ * Because readers may still walk a bucket array after the table has grown,
+ * replaced bucket arrays are kept until the table is destroyed; together they
+ * are never larger than the current array. Likewise, an entry removed from
+ * the table must not be freed or reused while lookups may still be running.
+ * The RCU helpers from rcu.h provide the required grace period: threads
+ * calling chtable_find() register with rcu_register_thread() and announce
+ * rcu_quiescent_state() between lookups, and a writer frees removed entries
+ * only after synchronize_rcu() has returned.
+ *
+ * Entries are struct htable_entry, so hash_entry() works on them too.
+ */
+
+/** Default number of lock stripes */
+#define CHTABLE_NUM_STRIPES 64
+
+/** Array of buckets */
+struct chtable_buckets {
+  /** Bucket array replaced by this one */
+  struct chtable_buckets *retired;
+  /** Number of buckets */
+  size_t size;
+  /** Heads of bucket lists */
+  struct hlist_head heads[];
+};
+
+/** Lock stripe */
+struct chtable_stripe {
+  /** Lock guarding buckets of the stripe */
+  struct seqlock lock;
+  /** Number of entries in buckets of the stripe */
+  size_t count;
+} ____cacheline_aligned;
+
+/** Concurrent hash table */
+struct chtable {
+  /** Current bucket array */
+  struct chtable_buckets *bucks;
+  /** Lock stripes */
+  struct chtable_stripe *stripes;
+  /** Number of lock stripes */
+  size_t nstripes;
+};
+
+static inline struct chtable_buckets *__chtable_alloc_buckets(size_t size) {
+  struct chtable_buckets *bucks;
+
+  bucks = (struct chtable_buckets *)malloc(sizeof(*bucks) + sizeof(struct hlist_head) * size);
+  if (bucks) {
+    bucks->retired = NULL;
+    bucks->size = size;
+    for (size_t i = 0; i < size; ++i) {
+      INIT_HLIST_HEAD(&bucks->heads[i]);
+    }
+  }
+  return bucks;
+}
+
+/**
+ * Initialize new concurrent table.
+ *
+ * @param table concurrent hash table
+ * @param n aproximate number of buckets
+ * @param nstripes aproximate number of lock stripes
+ */
+static inline int chtable_init_n(struct chtable *table, size_t n, size_t nstripes) {
+  if (!table) {
+    return -1;
+  }
+
+  table->nstripes = nstripes > 0 ? roundup_pow_of_two(nstripes) : CHTABLE_NUM_STRIPES;
+  n = max_t(size_t, n > 0 ? roundup_pow_of_two(n) : HASH_NUM_BUCKETS, table->nstripes);
+
+  table->bucks = __chtable_alloc_buckets(n);
+  assert(table->bucks);
+  if (posix_memalign((void **)&table->stripes, SMP_CACHE_BYTES, sizeof(struct chtable_stripe) * table->nstripes)) {
+    table->stripes = NULL;
+  }
+  assert(table->stripes);
+
+  for (size_t i = 0; i < table->nstripes; ++i) {
+    seqlock_init(&table->stripes[i].lock);
+    table->stripes[i].count = 0;
+  }
+
+  return 0;
+}
+
+/**
+ * Initialize new concurrent table.
+ *
+ * @param table concurrent hash table
+ */
+static inline int chtable_init(struct chtable *table) {
+  return chtable_init_n(table, HASH_NUM_BUCKETS, CHTABLE_NUM_STRIPES);
+}
+
+/**
+ * Destroy concurrent table.
+ *
+ * No other thread may use the table.
+ *
+ * @param table concurrent hash table
+ */
+static inline void chtable_destroy(struct chtable *table) {
+  struct chtable_buckets *bucks, *retired;
+
+  for (bucks = table->bucks; bucks; bucks = retired) {
+    retired = bucks->retired;
+    free(bucks);
+  }
+  free(table->stripes);
+}
+
+#define chtable_stripe(table, hash) (&(table)->stripes[(hash) & ((table)->nstripes - 1)])
+
+/**
+ * Get number of entries in the table.
+ *
+ * The result is exact only when no entries are being added or removed.
+ */
+static inline size_t chtable_count(const struct chtable *table) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < table->nstripes; ++i) {
+    count += ACCESS_ONCE(table->stripes[i].count);
+  }
+  return count;
+}
+
+/**
+ * Double the number of buckets.
+ *
+ * Takes all stripe locks, so that the entries can be moved at once.
+ *
+ * @param table concurrent hash table
+ * @param bucks bucket array which was found too small
+ */
+static inline void __chtable_grow(struct chtable *table, struct chtable_buckets *bucks) {
+  struct chtable_buckets *new;
+  struct hlist_node *pos, *tmp;
+
+  for (size_t i = 0; i < table->nstripes; ++i) {
+    write_seqlock(&table->stripes[i].lock);
+  }
+
+  // Another writer might have grown the table meanwhile
+  if (table->bucks == bucks && (new = __chtable_alloc_buckets(bucks->size * 2))) {
+    for (size_t i = 0; i < bucks->size; ++i) {
+      hlist_for_each_safe(pos, tmp, &bucks->heads[i]) {
+        struct htable_entry *e = hlist_entry(pos, struct htable_entry, node);
+        hlist_add_head(pos, &new->heads[e->hash & (new->size - 1)]);
+      }
+      INIT_HLIST_HEAD(&bucks->heads[i]);
+    }
+    new->retired = bucks;
+    atomic_thread_fence(memory_order_release);
+    ACCESS_ONCE(table->bucks) = new;
+  }
+
+  for (size_t i = table->nstripes; i-- > 0;) {
+    write_sequnlock(&table->stripes[i].lock);
+  }
+}
+
+/**
+ * Add a new entry into concurrent table.
+ *
+ * @param table the concurrent table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void chtable_add(struct chtable *table, struct htable_entry *entry, void *key, size_t len) {
+  struct chtable_stripe *stripe;
+  struct chtable_buckets *bucks;
+  struct hlist_head *head;
+  bool grow;
+
+  INIT_HTABLE_ENTRY(entry, key, len);
+  entry->hash = jhash(key, len, 0);
+
+  stripe = chtable_stripe(table, entry->hash);
+  write_seqlock(&stripe->lock);
+
+  bucks = table->bucks;
+  head = &bucks->heads[entry->hash & (bucks->size - 1)];
+
+  // Publish the entry only once it is fully initialized
+  entry->node.next = head->first;
+  entry->node.pprev = &head->first;
+  if (head->first) {
+    head->first->pprev = &entry->node.next;
+  }
+  atomic_thread_fence(memory_order_release);
+  ACCESS_ONCE(head->first) = &entry->node;
+
+  grow = ++stripe->count > bucks->size / table->nstripes * HASH_MAX_LOAD;
+  write_sequnlock(&stripe->lock);
+
+  if (grow) {
+    __chtable_grow(table, bucks);
+  }
+}
+
+/**
+ * Looks up a bucket for the presence of key without taking locks.
+ */
+static inline struct htable_entry *__chtable_bucket_find(const struct hlist_head *head, const void *key, size_t len, unsigned hash) {
+  struct hlist_node *n;
+
+  for (n = ACCESS_ONCE(head->first); n; n = ACCESS_ONCE(n->next)) {
+    struct htable_entry *e = hlist_entry(n, struct htable_entry, node);
+    if (ACCESS_ONCE(e->hash) == hash && ACCESS_ONCE(e->len) == len && __htable_key_eq(ACCESS_ONCE(e->key), key, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up the concurrent table for the presence of key.
+ *
+ * Takes no locks and may run concurrently with writers.
+ *
+ * @param table the concurrent table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct htable_entry *chtable_find(const struct chtable *table, const void *key, size_t len) {
+  unsigned hash = jhash(key, len, 0);
+  const struct chtable_stripe *stripe = chtable_stripe(table, hash);
+  struct htable_entry *e;
+  unsigned seq;
+
+  do {
+    seq = read_seqbegin(&stripe->lock);
+    struct chtable_buckets *bucks = ACCESS_ONCE(table->bucks);
+    e = __chtable_bucket_find(&bucks->heads[hash & (bucks->size - 1)], key, len, hash);
+  } while (read_seqretry(&stripe->lock, seq));
+
+  return e;
+}
+
+/**
+ * Remove entry from concurrent table, stripe lock must be held.
+ */
+static inline void __chtable_unlink(struct chtable_stripe *stripe, struct htable_entry *entry) {
+  __hlist_del(&entry->node);
+  entry->node.pprev = NULL;
+  stripe->count--;
+}
+
+/**
+ * Remove entry with given key from concurrent table.
+ *
+ * The removed entry may still be seen by running lookups, so it must not be
+ * freed or reused before synchronize_rcu() returns.
+ *
+ * @param table the concurrent table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct htable_entry *chtable_del_key(struct chtable *table, const void *key, size_t len) {
+  unsigned hash = jhash(key, len, 0);
+  struct chtable_stripe *stripe = chtable_stripe(table, hash);
+  struct htable_entry *e;
+
+  write_seqlock(&stripe->lock);
+  e = __htable_bucket_find(&table->bucks->heads[hash & (table->bucks->size - 1)], key, len, hash);
+  if (e) {
+    __chtable_unlink(stripe, e);
+  }
+  write_sequnlock(&stripe->lock);
+
+  return e;
+}
+
+/**
+ * Remove given entry from concurrent table.
+ *
+ * The removed entry may still be seen by running lookups, so it must not be
+ * freed or reused before synchronize_rcu() returns.
+ *
+ * @param table the concurrent table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct htable_entry *chtable_del_entry(struct chtable *table, struct htable_entry *entry) {
+  struct chtable_stripe *stripe = chtable_stripe(table, entry->hash);
+  bool hashed;
+
+  write_seqlock(&stripe->lock);
+  if ((hashed = !hlist_unhashed(&entry->node))) {
+    __chtable_unlink(stripe, entry);
+  }
+  write_sequnlock(&stripe->lock);
+
+  return hashed ? entry : NULL;
+}
+
+/**
+ * Looks up the concurrent table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define chash_find_entry(table, key, len, type, member) ({ \
+    struct htable_entry *e = chtable_find((table), (key), (len)); \
+    (type *)(e ? hash_entry(e, type, member) : NULL); })
+
+#endif // CHTABLE_H_
@@ -57,7 +57,9 @@
 #define __aligned(x) __attribute__((aligned(x)))
 #define __printf(a,b) __attribute__((format(printf,a,b)))
 #define noinline __attribute__((noinline))
+#ifndef __attribute_const__
 #define __attribute_const__ __attribute__((__const__))
+#endif
 #define __maybe_unused __attribute__((unused))
 #define __always_unused __attribute__((unused))
 
@@ -75,7 +77,9 @@
  */
 #define uninitialized_var(x) x = x
 
+#ifndef __always_inline
 #define __always_inline inline __attribute__((always_inline))
+#endif
 
 #if __GNUC__ == 4
 
@@ -132,6 +136,9 @@
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+/* Bring memory at address into cache ahead of use */
+#define prefetch(x) __builtin_prefetch(x)
+
 /* Optimization barrier */
 #ifndef barrier
 #define barrier() __memory_barrier()
@@ -0,0 +1,453 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CUCKOO_HTABLE_H_
+#define CUCKOO_HTABLE_H_
+
+#include "compiler.h"
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Bucketized cuckoo hash table.
+ *
+ * Every key has two candidate buckets given by two hash functions, jhash()
+ * with different initial values, and each bucket has a few slots. An entry
+ * is always stored in one of its two buckets, so a lookup reads at most two
+ * buckets, each a single cache line, whatever the load of the table. The
+ * slots hold a tag derived from both hashes next to the entry pointer, so
+ * entries are only dereferenced when their tag matches.
+ *
+ * When both buckets of a new entry are full, a breadth-first search looks
+ * for a short path of entries which can each move to their other bucket,
+ * ending in a free slot; the entries are then moved along the path. Tables
+ * grow when no such path is found.
+ */
+
+/** Number of slots in a bucket */
+#define CUCKOO_HTABLE_WAYS 4
+/** Default number of buckets */
+#define CUCKOO_HTABLE_NUM_BUCKETS 4
+#ifndef CUCKOO_HTABLE_MAX_LOAD
+/** Grow when the table is more than given number of sixteenths full */
+#define CUCKOO_HTABLE_MAX_LOAD 15
+#endif
+/** Number of buckets visited looking for a free slot before growing */
+#define CUCKOO_HTABLE_MAX_SEARCH 256
+/** Number of times an addition may double the table to find room for an entry */
+#define CUCKOO_HTABLE_MAX_GROW 4
+
+/** Initial values of the two hash functions */
+#define CUCKOO_HTABLE_SEED0 0
+#define CUCKOO_HTABLE_SEED1 0x9e3779b9
+
+/** Cuckoo hash table entry identified by key */
+struct cuckoo_htable_entry {
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Results of both hash functions applied to key */
+  uint32_t hash[2];
+};
+
+/** Bucket of slots, occupying a cache line */
+struct cuckoo_bucket {
+  /** Tags of entries in slots */
+  uint32_t tags[CUCKOO_HTABLE_WAYS];
+  /** Entries stored in the bucket, NULL for free slots */
+  struct cuckoo_htable_entry *slots[CUCKOO_HTABLE_WAYS];
+} __aligned(64);
+
+/** Cuckoo hash table */
+struct cuckoo_htable {
+  /** Buckets of the table */
+  struct cuckoo_bucket *bucks;
+  /** Number of buckets, power of two */
+  size_t size;
+  /** Number of entries in the table */
+  size_t count;
+};
+
+#define cuckoo_tag(hash0, hash1) ((hash0) ^ (hash1))
+
+/**
+ * Initialize new cuckoo hash table entry.
+ */
+static inline void INIT_CUCKOO_HTABLE_ENTRY(struct cuckoo_htable_entry *entry, void *key, size_t len) {
+  entry->key = key;
+  entry->len = len;
+  entry->hash[0] = jhash(key, len, CUCKOO_HTABLE_SEED0);
+  entry->hash[1] = jhash(key, len, CUCKOO_HTABLE_SEED1);
+}
+
+/**
+ * Allocate array of empty buckets.
+ *
+ * @param size number of buckets
+ */
+static inline struct cuckoo_bucket *__cuckoo_htable_alloc_buckets(size_t size) {
+  struct cuckoo_bucket *bucks;
+
+  if (posix_memalign((void **)&bucks, sizeof(struct cuckoo_bucket), sizeof(*bucks) * size)) {
+    return NULL;
+  }
+  memset(bucks, 0, sizeof(*bucks) * size);
+
+  return bucks;
+}
+
+/**
+ * Initialize new cuckoo table of given size.
+ *
+ * @param table cuckoo hash table
+ * @param n aproximate number of buckets, rounded up to power of two
+ */
+static inline int cuckoo_htable_init_n(struct cuckoo_htable *table, size_t n) {
+  if (!table) {
+    return -1;
+  }
+
+  table->size = n > 0 ? roundup_pow_of_two(n) : CUCKOO_HTABLE_NUM_BUCKETS;
+  table->count = 0;
+  table->bucks = __cuckoo_htable_alloc_buckets(table->size);
+  assert(table->bucks);
+
+  return 0;
+}
+
+/**
+ * Initialize new cuckoo hash table.
+ *
+ * @param table cuckoo hash table
+ */
+static inline int cuckoo_htable_init(struct cuckoo_htable *table) {
+  return cuckoo_htable_init_n(table, CUCKOO_HTABLE_NUM_BUCKETS);
+}
+
+/**
+ * Destroy cuckoo hash table.
+ *
+ * @param table cuckoo hash table
+ */
+static inline void cuckoo_htable_destroy(struct cuckoo_htable *table) {
+  if (table) {
+    free(table->bucks);
+  }
+}
+
+/**
+ * Get index of one of the two buckets of an entry.
+ */
+#define cuckoo_which_bucket(table, hash) ((hash) & ((table)->size - 1))
+
+/**
+ * Get index of the other bucket of an entry stored in given bucket.
+ */
+static inline size_t __cuckoo_alt_bucket(const struct cuckoo_htable *table, const struct cuckoo_htable_entry *entry, size_t buck) {
+  size_t b0 = cuckoo_which_bucket(table, entry->hash[0]);
+
+  return buck == b0 ? cuckoo_which_bucket(table, entry->hash[1]) : b0;
+}
+
+/**
+ * Store entry into a slot.
+ */
+static inline void __cuckoo_set_slot(struct cuckoo_bucket *b, int slot, struct cuckoo_htable_entry *entry) {
+  b->tags[slot] = cuckoo_tag(entry->hash[0], entry->hash[1]);
+  b->slots[slot] = entry;
+}
+
+/**
+ * Find a free slot in a bucket.
+ *
+ * @return slot index or -1 if the bucket is full
+ */
+static inline int __cuckoo_free_slot(const struct cuckoo_bucket *b) {
+  for (int i = 0; i < CUCKOO_HTABLE_WAYS; ++i) {
+    if (!b->slots[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/** Bucket reached by the search for a free slot */
+struct __cuckoo_path {
+  /** Index of the bucket */
+  size_t buck;
+  /** Index of the path node the entry moving here comes from, -1 for none */
+  int parent;
+  /** Slot of the moving entry in the parent bucket */
+  int slot;
+};
+
+/**
+ * Store entry into one of its buckets, moving other entries if needed.
+ *
+ * @return false if no free slot was found within CUCKOO_HTABLE_MAX_SEARCH buckets
+ */
+static inline bool __cuckoo_htable_place(struct cuckoo_htable *table, struct cuckoo_htable_entry *entry) {
+  struct __cuckoo_path path[CUCKOO_HTABLE_MAX_SEARCH];
+  int head = 0, tail = 0;
+
+  path[tail++] = (struct __cuckoo_path){ cuckoo_which_bucket(table, entry->hash[0]), -1, -1 };
+  path[tail++] = (struct __cuckoo_path){ cuckoo_which_bucket(table, entry->hash[1]), -1, -1 };
+
+  while (head < tail) {
+    int node = head++;
+    struct cuckoo_bucket *b = &table->bucks[path[node].buck];
+    int slot = __cuckoo_free_slot(b);
+
+    if (slot >= 0) {
+      // Move entries along the path, starting with the one next to the free slot
+      for (; path[node].parent >= 0; node = path[node].parent) {
+        struct cuckoo_bucket *from = &table->bucks[path[path[node].parent].buck];
+
+        __cuckoo_set_slot(&table->bucks[path[node].buck], slot, from->slots[path[node].slot]);
+        slot = path[node].slot;
+      }
+      __cuckoo_set_slot(&table->bucks[path[node].buck], slot, entry);
+      return true;
+    }
+
+    for (int i = 0; i < CUCKOO_HTABLE_WAYS && tail < CUCKOO_HTABLE_MAX_SEARCH; ++i) {
+      size_t alt = __cuckoo_alt_bucket(table, b->slots[i], path[node].buck);
+
+      if (alt != path[node].buck) {
+        path[tail++] = (struct __cuckoo_path){ alt, node, i };
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * Move all entries into a new array of buckets.
+ *
+ * Doubles the size further in the unlikely case the entries do not fit.
+ *
+ * @param table cuckoo hash table
+ * @param size new number of buckets, must be power of two
+ */
+static inline int cuckoo_htable_resize(struct cuckoo_htable *table, size_t size) {
+  struct cuckoo_htable old = *table;
+
+  for (;; size *= 2) {
+    bool placed = true;
+
+    if (!(table->bucks = __cuckoo_htable_alloc_buckets(size))) {
+      *table = old;
+      return -1;
+    }
+    table->size = size;
+
+    for (size_t i = 0; i < old.size && placed; ++i) {
+      for (int j = 0; j < CUCKOO_HTABLE_WAYS && placed; ++j) {
+        if (old.bucks[i].slots[j]) {
+          placed = __cuckoo_htable_place(table, old.bucks[i].slots[j]);
+        }
+      }
+    }
+    if (placed) {
+      break;
+    }
+    free(table->bucks);
+  }
+  free(old.bucks);
+
+  return 0;
+}
+
+/**
+ * Check whether both buckets of an entry are full of entries with its hashes.
+ *
+ * Such entries, usually having the same key, map to the same two buckets
+ * whatever the table size, so growing the table does not make room.
+ */
+static inline bool __cuckoo_htable_saturated(const struct cuckoo_htable *table, const struct cuckoo_htable_entry *entry) {
+  for (int h = 0; h < 2; ++h) {
+    const struct cuckoo_bucket *b = &table->bucks[cuckoo_which_bucket(table, entry->hash[h])];
+
+    for (int i = 0; i < CUCKOO_HTABLE_WAYS; ++i) {
+      if (!b->slots[i] || b->slots[i]->hash[0] != entry->hash[0] || b->slots[i]->hash[1] != entry->hash[1]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Add a new entry into cuckoo hash table.
+ *
+ * An entry has only two buckets, so at most 2 * CUCKOO_HTABLE_WAYS entries
+ * with the same key can be added.
+ *
+ * @param table the cuckoo hash table to insert entry into
+ * @param entry the cuckoo hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ * @return 0 on success, -1 if there is no room for the entry and the table
+ *         could not grow
+ */
+static inline int cuckoo_htable_add(struct cuckoo_htable *table, struct cuckoo_htable_entry *entry, void *key, size_t len) {
+  INIT_CUCKOO_HTABLE_ENTRY(entry, key, len);
+
+  if ((table->count + 1) * 16 > table->size * CUCKOO_HTABLE_WAYS * CUCKOO_HTABLE_MAX_LOAD) {
+    cuckoo_htable_resize(table, table->size * 2);
+  }
+
+  for (int grow = 0; !__cuckoo_htable_place(table, entry); ++grow) {
+    if (grow == CUCKOO_HTABLE_MAX_GROW || __cuckoo_htable_saturated(table, entry) ||
+        cuckoo_htable_resize(table, table->size * 2)) {
+      return -1;
+    }
+  }
+  table->count++;
+
+  return 0;
+}
+
+/**
+ * Looks up a bucket for slot holding the key.
+ *
+ * @return slot index or -1 if there is no such entry
+ */
+static inline int __cuckoo_bucket_find(const struct cuckoo_bucket *b, uint32_t tag, const void *key, size_t len) {
+  for (int i = 0; i < CUCKOO_HTABLE_WAYS; ++i) {
+    const struct cuckoo_htable_entry *e = b->slots[i];
+
+    if (b->tags[i] == tag && e && e->len == len && memcmp(e->key, key, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Looks up the cuckoo hash table for the presence of key.
+ *
+ * Reads at most two buckets.
+ *
+ * @param table the cuckoo hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct cuckoo_htable_entry *cuckoo_htable_find(const struct cuckoo_htable *table, const void *key, size_t len) {
+  uint32_t hash0 = jhash(key, len, CUCKOO_HTABLE_SEED0);
+  uint32_t hash1 = jhash(key, len, CUCKOO_HTABLE_SEED1);
+  uint32_t tag = cuckoo_tag(hash0, hash1);
+  const struct cuckoo_bucket *b0 = &table->bucks[cuckoo_which_bucket(table, hash0)];
+  const struct cuckoo_bucket *b1 = &table->bucks[cuckoo_which_bucket(table, hash1)];
+  int slot;
+
+  // Load both buckets at once rather than one after the other
+  prefetch(b1);
+
+  if ((slot = __cuckoo_bucket_find(b0, tag, key, len)) >= 0) {
+    return b0->slots[slot];
+  }
+  if ((slot = __cuckoo_bucket_find(b1, tag, key, len)) >= 0) {
+    return b1->slots[slot];
+  }
+  return NULL;
+}
+
+/**
+ * Remove given entry from cuckoo hash table.
+ *
+ * @param table the cuckoo hash table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct cuckoo_htable_entry *cuckoo_htable_del_entry(struct cuckoo_htable *table, struct cuckoo_htable_entry *entry) {
+  for (int h = 0; h < 2; ++h) {
+    struct cuckoo_bucket *b = &table->bucks[cuckoo_which_bucket(table, entry->hash[h])];
+
+    for (int i = 0; i < CUCKOO_HTABLE_WAYS; ++i) {
+      if (b->slots[i] == entry) {
+        b->slots[i] = NULL;
+        table->count--;
+        return entry;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Remove entry with given key from cuckoo hash table.
+ *
+ * @param table the cuckoo hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct cuckoo_htable_entry *cuckoo_htable_del_key(struct cuckoo_htable *table, const void *key, size_t len) {
+  struct cuckoo_htable_entry *entry = cuckoo_htable_find(table, key, len);
+
+  if (entry) {
+    cuckoo_htable_del_entry(table, entry);
+  }
+  return entry;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the cuckoo hash table entry pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define cuckoo_hash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the cuckoo hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define cuckoo_hash_find_entry(table, key, len, type, member) ({ \
+    struct cuckoo_htable_entry *e = cuckoo_htable_find((table), (key), (len)); \
+    (type *)(e ? cuckoo_hash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over cuckoo hash table elements of given type.
+ *
+ * Entries may be removed from the table while iterating.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define cuckoo_htable_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < (table)->size * CUCKOO_HTABLE_WAYS; ++i) \
+    for (pos = (table)->bucks[i / CUCKOO_HTABLE_WAYS].slots[i % CUCKOO_HTABLE_WAYS]; \
+         pos && ({ tpos = cuckoo_hash_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = NULL)
+
+#endif // CUCKOO_HTABLE_H_
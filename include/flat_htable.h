@@ -0,0 +1,449 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLAT_HTABLE_H_
+#define FLAT_HTABLE_H_
+
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Open addressing hash table.
+ *
+ * Each slot has a control byte which is either empty, deleted or holds the
+ * seven top bits of the entry hash. Lookups scan control bytes of a group of
+ * slots at once and only dereference entries whose control byte matches, so
+ * a probe usually touches a single cache line of control bytes and a single
+ * entry. The control array is followed by a copy of its first group, which
+ * allows loading a group starting at any slot without wrapping around.
+ */
+
+/** Number of slots scanned at once */
+#define FLAT_HTABLE_GROUP 16
+/** Default number of slots */
+#define FLAT_HTABLE_NUM_SLOTS 16
+#ifndef FLAT_HTABLE_MAX_LOAD
+/** Grow when the table is more than given number of sixteenths full */
+#define FLAT_HTABLE_MAX_LOAD 14
+#endif
+
+#define FLAT_CTRL_EMPTY ((int8_t)-128)
+#define FLAT_CTRL_DELETED ((int8_t)-2)
+
+#define flat_ctrl_full(c) ((c) >= 0)
+#define flat_ctrl_hash(hash) ((int8_t)((hash) >> 25))
+
+/** Flat hash table entry identified by key */
+struct flat_htable_entry {
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Result of hash function applied to key */
+  unsigned hash;
+};
+
+/** Flat hash table of entries */
+struct flat_htable {
+  /** Control byte for each slot followed by a copy of the first group */
+  int8_t *ctrl;
+  /** Entries stored in the table */
+  struct flat_htable_entry **slots;
+  /** Number of slots, power of two */
+  size_t size;
+  /** Number of entries in the table */
+  size_t count;
+  /** Number of entries which can be added before the table grows */
+  size_t growth_left;
+};
+
+#ifdef __SSE2__
+
+static inline uint32_t __flat_group_match(const int8_t *ctrl, int8_t c) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c), group));
+}
+
+static inline uint32_t __flat_group_match_free(const int8_t *ctrl) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));
+}
+
+#else
+
+static inline uint32_t __flat_group_match(const int8_t *ctrl, int8_t c) {
+  uint32_t mask = 0;
+
+  for (int i = 0; i < FLAT_HTABLE_GROUP; ++i) {
+    mask |= (uint32_t)(ctrl[i] == c) << i;
+  }
+  return mask;
+}
+
+static inline uint32_t __flat_group_match_free(const int8_t *ctrl) {
+  uint32_t mask = 0;
+
+  for (int i = 0; i < FLAT_HTABLE_GROUP; ++i) {
+    mask |= (uint32_t)(ctrl[i] < -1) << i;
+  }
+  return mask;
+}
+
+#endif
+
+#define __flat_group_match_empty(ctrl) __flat_group_match((ctrl), FLAT_CTRL_EMPTY)
+
+/**
+ * Iterate over set bits of a group match mask.
+ *
+ * @param bit int to use as a loop cursor
+ * @param mask match mask
+ */
+#define __flat_for_each_match(bit, mask) \
+  for (uint32_t __m = (mask); __m && ({ bit = __builtin_ctz(__m); 1; }); __m &= __m - 1)
+
+/**
+ * Set control byte of a slot, keeping the copy of the first group in sync.
+ */
+static inline void __flat_set_ctrl(struct flat_htable *table, size_t i, int8_t c) {
+  table->ctrl[i] = c;
+  if (i < FLAT_HTABLE_GROUP) {
+    table->ctrl[table->size + i] = c;
+  }
+}
+
+/**
+ * Initialize new flat hash table entry.
+ */
+static inline void INIT_FLAT_HTABLE_ENTRY(struct flat_htable_entry *entry, void *key, size_t len) {
+  entry->key = key;
+  entry->len = len;
+}
+
+/**
+ * Allocate slots of the table.
+ *
+ * @param table flat hash table
+ * @param size number of slots, power of two no smaller than a group
+ */
+static inline int __flat_htable_alloc(struct flat_htable *table, size_t size) {
+  int8_t *ctrl = (int8_t *)malloc(size + FLAT_HTABLE_GROUP);
+  struct flat_htable_entry **slots = (struct flat_htable_entry **)malloc(sizeof(*slots) * size);
+
+  if (!ctrl || !slots) {
+    free(ctrl);
+    free(slots);
+    return -1;
+  }
+  memset(ctrl, FLAT_CTRL_EMPTY, size + FLAT_HTABLE_GROUP);
+
+  table->ctrl = ctrl;
+  table->slots = slots;
+  table->size = size;
+  table->growth_left = size * FLAT_HTABLE_MAX_LOAD / 16 - table->count;
+
+  return 0;
+}
+
+/**
+ * Initialize new flat table of given size.
+ *
+ * @param table flat hash table
+ * @param n aproximate number of slots, rounded up to power of two
+ */
+static inline int flat_htable_init_n(struct flat_htable *table, size_t n) {
+  if (!table) {
+    return -1;
+  }
+
+  table->ctrl = NULL;
+  table->slots = NULL;
+  table->size = table->count = table->growth_left = 0;
+
+  n = n > FLAT_HTABLE_GROUP ? roundup_pow_of_two(n) : FLAT_HTABLE_GROUP;
+  if (__flat_htable_alloc(table, n)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Initialize new flat hash table.
+ *
+ * @param table flat hash table
+ */
+static inline int flat_htable_init(struct flat_htable *table) {
+  return flat_htable_init_n(table, FLAT_HTABLE_NUM_SLOTS);
+}
+
+/**
+ * Destroy flat hash table.
+ *
+ * @param table flat hash table
+ */
+static inline void flat_htable_destroy(struct flat_htable *table) {
+  if (table) {
+    free(table->ctrl);
+    free(table->slots);
+  }
+}
+
+/**
+ * Find first free slot on the probe sequence of given hash.
+ */
+static inline size_t __flat_find_free(const struct flat_htable *table, unsigned hash) {
+  size_t mask = table->size - 1;
+  size_t pos = hash & mask;
+
+  for (size_t step = FLAT_HTABLE_GROUP;; step += FLAT_HTABLE_GROUP) {
+    uint32_t avail = __flat_group_match_free(&table->ctrl[pos]);
+    if (avail) {
+      return (pos + __builtin_ctz(avail)) & mask;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+/**
+ * Rehash all entries into a table of given size, dropping deleted slots.
+ *
+ * @param table flat hash table
+ * @param size new number of slots
+ */
+static inline int flat_htable_resize(struct flat_htable *table, size_t size) {
+  struct flat_htable old = *table;
+
+  if (__flat_htable_alloc(table, size)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < old.size; ++i) {
+    if (flat_ctrl_full(old.ctrl[i])) {
+      struct flat_htable_entry *e = old.slots[i];
+      size_t slot = __flat_find_free(table, e->hash);
+
+      __flat_set_ctrl(table, slot, flat_ctrl_hash(e->hash));
+      table->slots[slot] = e;
+    }
+  }
+
+  free(old.ctrl);
+  free(old.slots);
+
+  return 0;
+}
+
+/**
+ * Add a new entry into flat hash table.
+ *
+ * @param table the flat hash table to insert entry into
+ * @param entry the flat hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ * @return 0 on success, -1 if the table is full and cannot grow
+ */
+static inline int flat_htable_add(struct flat_htable *table, struct flat_htable_entry *entry, void *key, size_t len) {
+  INIT_FLAT_HTABLE_ENTRY(entry, key, len);
+
+  unsigned hash = jhash(key, len, 0);
+  entry->hash = hash;
+
+  size_t slot = __flat_find_free(table, hash);
+  if (table->growth_left == 0 && table->ctrl[slot] == FLAT_CTRL_EMPTY) {
+    // Reclaim deleted slots first if they make up a large part of the table
+    size_t size = table->count * 32 <= table->size * FLAT_HTABLE_MAX_LOAD ? table->size : table->size * 2;
+    if (flat_htable_resize(table, size)) {
+      return -1;
+    }
+    slot = __flat_find_free(table, hash);
+  }
+
+  if (table->ctrl[slot] == FLAT_CTRL_EMPTY && table->growth_left > 0) {
+    table->growth_left--;
+  }
+  __flat_set_ctrl(table, slot, flat_ctrl_hash(hash));
+  table->slots[slot] = entry;
+
+  table->count++;
+
+  return 0;
+}
+
+/**
+ * Looks up the flat hash table for slot holding the key.
+ *
+ * @return slot index or -1 if there is no such entry
+ */
+static inline ssize_t __flat_htable_find_slot(const struct flat_htable *table, const void *key, size_t len, unsigned hash) {
+  size_t mask = table->size - 1;
+  size_t pos = hash & mask;
+  int8_t c = flat_ctrl_hash(hash);
+  int bit;
+
+  for (size_t step = FLAT_HTABLE_GROUP;; step += FLAT_HTABLE_GROUP) {
+    const int8_t *group = &table->ctrl[pos];
+
+    __flat_for_each_match(bit, __flat_group_match(group, c)) {
+      size_t slot = (pos + bit) & mask;
+      struct flat_htable_entry *e = table->slots[slot];
+      if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0) {
+        return slot;
+      }
+    }
+    if (__flat_group_match_empty(group)) {
+      return -1;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+/**
+ * Looks up the flat hash table for the presence of key.
+ *
+ * @param table the flat hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct flat_htable_entry *flat_htable_find(const struct flat_htable *table, const void *key, size_t len) {
+  ssize_t slot = __flat_htable_find_slot(table, key, len, jhash(key, len, 0));
+  return slot >= 0 ? table->slots[slot] : NULL;
+}
+
+/**
+ * Remove entry in given slot.
+ *
+ * The slot is marked empty rather than deleted when no probe sequence could
+ * have continued past it, i.e. when every group containing it has a free slot.
+ */
+static inline struct flat_htable_entry *__flat_htable_del_slot(struct flat_htable *table, size_t slot) {
+  struct flat_htable_entry *entry = table->slots[slot];
+  size_t mask = table->size - 1;
+
+  uint32_t empty_after = __flat_group_match_empty(&table->ctrl[slot]);
+  uint32_t empty_before = __flat_group_match_empty(&table->ctrl[(slot - FLAT_HTABLE_GROUP) & mask]);
+  bool never_full = empty_before && empty_after &&
+    __builtin_ctz(empty_after) + __builtin_clz(empty_before << 16) < FLAT_HTABLE_GROUP;
+
+  __flat_set_ctrl(table, slot, never_full ? FLAT_CTRL_EMPTY : FLAT_CTRL_DELETED);
+  if (never_full) {
+    table->growth_left++;
+  }
+  table->count--;
+
+  return entry;
+}
+
+/**
+ * Remove entry with given key from flat hash table.
+ *
+ * @param table the flat hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct flat_htable_entry *flat_htable_del_key(struct flat_htable *table, const void *key, size_t len) {
+  ssize_t slot = __flat_htable_find_slot(table, key, len, jhash(key, len, 0));
+  return slot >= 0 ? __flat_htable_del_slot(table, slot) : NULL;
+}
+
+/**
+ * Remove given entry from flat hash table.
+ *
+ * @param table the flat hash table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct flat_htable_entry *flat_htable_del_entry(struct flat_htable *table, struct flat_htable_entry *entry) {
+  size_t mask = table->size - 1;
+  size_t pos = entry->hash & mask;
+  int8_t c = flat_ctrl_hash(entry->hash);
+  int bit;
+
+  for (size_t step = FLAT_HTABLE_GROUP; step <= table->size; step += FLAT_HTABLE_GROUP) {
+    const int8_t *group = &table->ctrl[pos];
+
+    __flat_for_each_match(bit, __flat_group_match(group, c)) {
+      size_t slot = (pos + bit) & mask;
+      if (table->slots[slot] == entry) {
+        return __flat_htable_del_slot(table, slot);
+      }
+    }
+    if (__flat_group_match_empty(group)) {
+      break;
+    }
+    pos = (pos + step) & mask;
+  }
+  return NULL;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the flat hash table entry pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define flat_hash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the flat hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define flat_hash_find_entry(table, key, len, type, member) ({ \
+    struct flat_htable_entry *e = flat_htable_find((table), (key), (len)); \
+    (type *)(e ? flat_hash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over flat hash table elements.
+ *
+ * @param pos struct flat_htable_entry to use as a loop counter
+ * @param table your table
+ */
+#define flat_htable_for_each(pos, table) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    for (pos = flat_ctrl_full((table)->ctrl[i]) ? (table)->slots[i] : NULL; pos; pos = NULL)
+
+/**
+ * Iterate over flat hash table elements of given type.
+ *
+ * Entries may be removed from the table while iterating.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define flat_htable_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    for (pos = flat_ctrl_full((table)->ctrl[i]) ? (table)->slots[i] : NULL; \
+         pos && ({ tpos = flat_hash_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = NULL)
+
+#endif // FLAT_HTABLE_H_
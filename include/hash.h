@@ -79,7 +79,7 @@ static inline unsigned long hash_ptr(const void *ptr, unsigned int bits) {
 
 static inline unsigned long hash_internal(const void *data, unsigned int len) {
   unsigned char *p = (unsigned char *)data;
-  unsigned char *e = *p + len;
+  unsigned char *e = p + len;
   uint32_t h = 0xfeedbeef;
 
   while (p < e) {
@@ -19,6 +19,7 @@
 #define HLIST_H_
 
 #include "kernel.h"
+#include "rcu.h"
 
 #include <stddef.h>
 
@@ -142,6 +143,56 @@ static inline void hlist_add_after(struct hlist_node *n, struct hlist_node *next
         next->next->pprev  = &next->next;
 }
 
+/**
+ * Deletes entry from list without disturbing concurrent RCU readers.
+ *
+ * The entry keeps pointing to its successor, so that readers currently at
+ * the entry can continue the traversal. It must not be freed or reused until
+ * a grace period has elapsed, see synchronize_rcu().
+ *
+ * @param n element to delete from the list
+ */
+static inline void hlist_del_rcu(struct hlist_node *n) {
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+    ACCESS_ONCE(*pprev) = next;
+    if (next)
+        next->pprev = pprev;
+    n->pprev = NULL;
+}
+
+/**
+ * Add a new entry visible to concurrent RCU readers.
+ *
+ * The entry is fully linked before it is published by the list head. Updates
+ * must still be serialized against each other.
+ *
+ * @param n new entry to be added
+ * @param h list head to add it after
+ */
+static inline void hlist_add_head_rcu(struct hlist_node *n, struct hlist_head *h) {
+    struct hlist_node *first = h->first;
+    n->next = first;
+    n->pprev = &h->first;
+    rcu_assign_pointer(h->first, n);
+    if (first)
+        first->pprev = &n->next;
+}
+
+/**
+ * Add a new entry after an existing one, visible to concurrent RCU readers.
+ *
+ * @param n entry already in the list
+ * @param next new entry to add after it
+ */
+static inline void hlist_add_after_rcu(struct hlist_node *n, struct hlist_node *next) {
+    next->next = n->next;
+    next->pprev = &n->next;
+    rcu_assign_pointer(n->next, next);
+    if (next->next)
+        next->next->pprev = &next->next;
+}
+
 /**
  * Move a list from one list head to another.
  *
@@ -256,4 +307,20 @@ static inline void hlist_move_list(struct hlist_head *old, struct hlist_head *ne
          pos && ({ n = pos->next; 1; }) && ({ tpos = hlist_entry(pos, typeof(*tpos), member); 1;}); \
          pos = n)
 
+/**
+ * Iterate over RCU-protected list of given type.
+ *
+ * May run concurrently with hlist_add_head_rcu() and hlist_del_rcu(), within
+ * read-side critical section.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos node pointer to use as a loop cursor
+ * @param head head for your list
+ * @param member name of the list structure within the struct
+ */
+#define hlist_for_each_entry_rcu(tpos, pos, head, member) \
+    for (pos = rcu_dereference((head)->first); \
+         pos && ({ tpos = hlist_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = rcu_dereference(pos->next))
+
 #endif // HLIST_H_
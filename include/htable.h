@@ -18,39 +18,56 @@
 #ifndef HTABLE_H_
 #define HTABLE_H_
 
+#include "bloom.h"
 #include "jhash.h"
 #include "hlist.h"
 #include "kernel.h"
 #include "log2.h"
+#include "rcu.h"
+#include "spinlock.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define BLOOM_BIT_LENGTH 8
+/** Default number of buckets */
+#define HASH_NUM_BUCKETS 16
+/** Expand when average number of entries per bucket exceeds threshold */
+#define HASH_MAX_LOAD 1
+/** Shrink when average number of entries per bucket drops below HASH_MAX_LOAD / 2^shift */
+#define HASH_SHRINK_SHIFT 3
+/** Number of buckets migrated by each addition or removal while resizing */
+#define HASH_REHASH_STEP 4
+/** Number of Bloom filter bits per bucket as power of two */
+#define HASH_BLOOM_SHIFT 3
 
-#define bloom_init(bitvect) ({ \
-    (bitvect) = (uint8_t *)malloc((1ULL << BLOOM_BIT_LENGTH) / BITS_PER_BYTE); \
-    assert((bitvect)); \
-    memset((bitvect), 0, (1ULL << BLOOM_BIT_LENGTH) / BITS_PER_BYTE); })
-#define bloom_finit(bitvect) free((bitvect))
+/** Number of keys whose lookups are overlapped by htable_find_batch() */
+#ifndef HASH_BATCH_SIZE
+#define HASH_BATCH_SIZE 16
+#endif
 
-#define bloom_set_bit(bits, idx) \
-  (bits[(idx) / BITS_PER_BYTE] |= (1U << ((idx) % BITS_PER_BYTE)))
-#define bloom_test_bit(bits, idx) \
-  (bits[(idx) / BITS_PER_BYTE] & (1U << ((idx) % BITS_PER_BYTE)))
+/** Use counting Bloom filter, so that removed keys are cleared from it */
+#define HTABLE_BLOOM_COUNTING 0x1
 
-#define bloom_set(bitvect, hash) \
-  bloom_set_bit((bitvect), (hash & (uint32_t)((1ULL << BLOOM_BIT_LENGTH) - 1)))
-#define bloom_test(bitvect, hash) \
-  bloom_test_bit((bitvect), (hash & (uint32_t)((1ULL << BLOOM_BIT_LENGTH) - 1)))
+/** Seed the hash function randomly, see htable_init_hash() */
+#define HTABLE_RANDOM_SEED 0x2
 
-/** Default number of buckets */
-#define HASH_NUM_BUCKETS 16
-/** Expand when bucket count reach threshold */
-#define HASH_BUCKET_THRESH 10
+/** Keep entries with equal keys next to each other, see htable_find_all() */
+#define HTABLE_MULTIMAP 0x4
+
+/**
+ * Hash function used by hash table, jhash() is one.
+ *
+ * @param key the key to hash
+ * @param len the length of the key
+ * @param seed the seed of the table
+ */
+typedef uint32_t (*htable_hash_f)(const void *key, uint32_t len, uint32_t seed);
 
 /** Hash table entry identified by key */
 struct htable_entry {
@@ -64,14 +81,37 @@ struct htable_entry {
   unsigned hash;
 };
 
-/** Hash table bucket */
-struct htable_bucket {
-  /** Head of list of entries in the bucket */
-  struct hlist_head head;
-  /** Number of entries in the bucket */
-  size_t count;
-  /** Expansion multiplier, postpones multiplication */
-  unsigned expand_mult;
+/** Longest key stored inline by htable_add_inline() */
+#define HTABLE_INLINE_KEY 16
+
+/**
+ * Hash table entry storing short keys inline.
+ *
+ * Keys of up to HTABLE_INLINE_KEY bytes are copied next to the list node,
+ * length and cached hash, so comparing them does not miss the cache once
+ * more; longer keys are pointed to as with struct htable_entry. As the entry
+ * then points into itself, it must not be moved while in the table.
+ *
+ * Longer keys are not copied: the entry keeps the caller's pointer, so the
+ * key must stay valid and unchanged while the entry is in the table.
+ */
+struct htable_inline_entry {
+  /** Hash table entry, its key pointing to @p key for short keys */
+  struct htable_entry entry;
+  /** Copy of short keys */
+  uint8_t key[HTABLE_INLINE_KEY];
+};
+
+/** Bucket array replaced while lookups under RCU may still walk it */
+struct htable_retired {
+  /** Next retired array */
+  struct htable_retired *next;
+  /** Grace period to wait for, see get_state_synchronize_rcu() */
+  unsigned long gp;
+  /** Retired buckets */
+  struct hlist_head *bucks;
+  /** Bloom filter of keys in @p bucks */
+  struct bloom bloom;
 };
 
 /** Hash table containing buckets full of entries */
@@ -82,146 +122,1283 @@ struct htable {
   size_t size;
   /** Number of entries in the table */
   size_t count;
-  /** Bloom filter bit vector */
-  uint8_t *bitvect;
+  /** Number of buckets the table does not shrink below on its own */
+  size_t min_size;
+  /** Bloom filter of keys in @p bucks */
+  struct bloom bloom;
+  /** Buckets being migrated into @p bucks while resizing, NULL otherwise */
+  struct hlist_head *old_bucks;
+  /** Bloom filter of keys in @p old_bucks */
+  struct bloom old_bloom;
+  /** Number of buckets in @p old_bucks */
+  size_t old_size;
+  /** Index of the next bucket in @p old_bucks to be migrated */
+  size_t rehash_idx;
+  /** Table flags */
+  unsigned flags;
+  /** Hash function, NULL for jhash() */
+  htable_hash_f hashfn;
+  /** Seed passed to the hash function */
+  uint32_t seed;
+  /** Odd while buckets are migrated or replaced, for lookups under RCU */
+  struct seqcount seq;
+  /** Bucket arrays to be freed once lookups under RCU are done with them */
+  struct htable_retired *retired;
+  /** Number of lookups, not counting lookups under RCU */
+  size_t lookups;
+  /** Number of entries compared by lookups */
+  size_t probes;
+  /** Number of lookups rejected by Bloom filter of @p bucks */
+  size_t bloom_rejects;
 };
 
+/*
+ * Defining HTABLE_STATS before including this header makes lookups count
+ * probes into the table, see htable_stats(). The counters are part of the
+ * table either way, so that its layout does not depend on the macro, but
+ * are left at zero without it. Lookups otherwise leave the table untouched,
+ * so the counters are updated through a non-const pointer.
+ *
+ * The counters are plain integers, not atomics, to keep counting cheap.
+ * With HTABLE_STATS, lookups into one table must therefore not run in
+ * several threads at once, although a const table otherwise allows it.
+ * Lookups under RCU are not counted and remain safe.
+ */
+#ifdef HTABLE_STATS
+#define __htable_stat_add(table, counter, n) (((struct htable *)(table))->counter += (n))
+#else
+#define __htable_stat_add(table, counter, n) do { } while (0)
+#endif
+
 #define htable_which_bucket(table, hash) ((hash) & ((table)->size - 1))
 
 /**
- * Initialize new hash table entry.
+ * Initialize new hash table entry.
+ */
+static inline void INIT_HTABLE_ENTRY(struct htable_entry *entry, void *key, size_t len) {
+  INIT_HLIST_NODE(&entry->node);
+  entry->key = key;
+  entry->len = len;
+}
+
+/**
+ * Allocate array of empty buckets.
+ *
+ * @param size number of buckets
+ */
+static inline struct hlist_head *__htable_alloc_buckets(size_t size) {
+  struct hlist_head *bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * size);
+
+  if (bucks) {
+    for (size_t i = 0; i < size; ++i) {
+      INIT_HLIST_HEAD(&bucks[i]);
+    }
+  }
+  return bucks;
+}
+
+/**
+ * Initialize Bloom filter sized for given number of buckets.
+ *
+ * @param table hash table
+ * @param bloom Bloom filter
+ * @param size number of buckets
+ */
+static inline int __htable_bloom_init(const struct htable *table, struct bloom *bloom, size_t size) {
+  return bloom_init(bloom, ilog2(size) + HASH_BLOOM_SHIFT, table->flags & HTABLE_BLOOM_COUNTING);
+}
+
+/**
+ * Get a seed which differs between tables and between runs.
+ *
+ * Mixes current time with addresses randomized by the loader. Both can be
+ * guessed, so the seed must not be relied upon to be secret.
+ */
+static inline uint32_t __htable_random_seed(const struct htable *table) {
+  struct timespec ts;
+  uint64_t ns;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  return jhash_3words((uint32_t)ns, (uint32_t)(ns >> 32), (uint32_t)(uintptr_t)table,
+      (uint32_t)((uintptr_t)&ts >> 4));
+}
+
+/**
+ * Initialize new table of given size using given hash function.
+ *
+ * With a fixed seed, keys fall into the same buckets in every run. The seed
+ * chosen by HTABLE_RANDOM_SEED varies between tables and runs, but it is
+ * neither secret nor hard to guess, and jhash() is not designed to resist
+ * keys chosen to collide. Neither protects against hash flooding; tables
+ * exposed to untrusted keys need a keyed hash function with a secret key,
+ * passed as hashfn. The seed is kept when the table is resized.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to power of two
+ * @param flags table flags
+ * @param hashfn hash function, NULL for jhash()
+ * @param seed seed passed to the hash function, ignored with HTABLE_RANDOM_SEED
+ */
+static inline int htable_init_hash(struct htable *table, size_t n, unsigned flags, htable_hash_f hashfn, uint32_t seed) {
+  if (!table) {
+    return -1;
+  }
+
+  table->size = n > 0 ? roundup_pow_of_two(n) : HASH_NUM_BUCKETS;
+  table->bucks = __htable_alloc_buckets(table->size);
+  assert(table->bucks);
+
+  table->count = 0;
+  table->min_size = table->size;
+  table->flags = flags;
+  table->hashfn = hashfn;
+  table->seed = flags & HTABLE_RANDOM_SEED ? __htable_random_seed(table) : seed;
+  table->old_bucks = NULL;
+  table->old_bloom.bits = NULL;
+  table->old_size = 0;
+  table->rehash_idx = 0;
+  seqcount_init(&table->seq);
+  table->retired = NULL;
+  table->lookups = table->probes = table->bloom_rejects = 0;
+  __htable_bloom_init(table, &table->bloom, table->size);
+  assert(table->bloom.bits);
+
+  return 0;
+}
+
+/**
+ * Initialize new table of given size.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to power of two
+ * @param flags table flags
+ */
+static inline int htable_init_flags(struct htable *table, size_t n, unsigned flags) {
+  return htable_init_hash(table, n, flags, NULL, 0);
+}
+
+/**
+ * Initialize new table of given size.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to power of two
+ */
+static inline int htable_init_n(struct htable *table, size_t n) {
+  return htable_init_flags(table, n, 0);
+}
+
+/**
+ * Initialize new hash table.
+ *
+ * @param table hash table
+ */
+static inline int htable_init(struct htable *table) {
+  return htable_init_n(table, HASH_NUM_BUCKETS);
+}
+
+/**
+ * Destroy hash table.
+ *
+ * @param table hash table
+ */
+static inline void htable_destroy(struct htable *table) {
+  struct htable_retired *r;
+
+  if (!table) {
+    return;
+  }
+  free(table->bucks);
+  free(table->old_bucks);
+  bloom_destroy(&table->bloom);
+  bloom_destroy(&table->old_bloom);
+  while ((r = table->retired)) {
+    table->retired = r->next;
+    free(r->bucks);
+    bloom_destroy(&r->bloom);
+    free(r);
+  }
+}
+
+/**
+ * Hash key using the hash function and seed of the table.
+ */
+static inline unsigned __htable_hash(const struct htable *table, const void *key, size_t len) {
+  if (table->hashfn) {
+    return table->hashfn(key, len, table->seed);
+  }
+  return jhash(key, len, table->seed);
+}
+
+/**
+ * Tests whether the table is migrating entries into new buckets.
+ *
+ * @param table hash table
+ */
+static inline bool htable_rehashing(const struct htable *table) {
+  return table->old_bucks != NULL;
+}
+
+/**
+ * Move entries of up to n old buckets into the new ones.
+ *
+ * @param rcu whether lookups may be running under RCU
+ * @return true if all old buckets have been migrated
+ */
+static inline bool __htable_migrate(struct htable *table, size_t n, bool rcu) {
+  struct hlist_node *pos, *tmp;
+
+  // Lookups may miss the entries while they are moved, so make them retry
+  if (rcu) {
+    write_seqcount_begin(&table->seq);
+  }
+
+  while (n-- > 0 && table->rehash_idx < table->old_size) {
+    struct hlist_head *old = &table->old_bucks[table->rehash_idx++];
+
+    hlist_for_each_safe(pos, tmp, old) {
+      struct htable_entry *e = hlist_entry(pos, struct htable_entry, node);
+
+      __hlist_del(pos);
+      bloom_add(&table->bloom, e->hash);
+      hlist_add_head_rcu(pos, &table->bucks[htable_which_bucket(table, e->hash)]);
+    }
+  }
+
+  if (rcu) {
+    write_seqcount_end(&table->seq);
+  }
+
+  return table->rehash_idx == table->old_size;
+}
+
+/**
+ * Forget old buckets once they have been migrated.
+ */
+static inline void __htable_end_rehash(struct htable *table) {
+  table->old_bucks = NULL;
+  table->old_bloom.bits = NULL;
+  table->old_size = 0;
+  table->rehash_idx = 0;
+}
+
+/**
+ * Migrate entries from old buckets into the new ones.
+ *
+ * Resizing is done incrementally: each addition or removal moves only a few
+ * buckets, so there is never a single long stall while rehashing the whole
+ * table. Both bucket arrays are searched until the migration completes.
+ *
+ * @param table hash table
+ * @param n number of old buckets to migrate
+ */
+static inline void htable_rehash_step(struct htable *table, size_t n) {
+  if (htable_rehashing(table) && __htable_migrate(table, n, false)) {
+    free(table->old_bucks);
+    bloom_destroy(&table->old_bloom);
+    __htable_end_rehash(table);
+  }
+}
+
+/**
+ * Free retired bucket arrays whose grace period has elapsed.
+ *
+ * Called by every update under RCU, so the arrays are freed soon after any
+ * thread has run synchronize_rcu(), e.g. to free removed entries.
+ *
+ * @param table hash table
+ */
+static inline void htable_reclaim_rcu(struct htable *table) {
+  struct htable_retired **pos = &table->retired, *r;
+
+  while ((r = *pos)) {
+    if (poll_state_synchronize_rcu(r->gp)) {
+      *pos = r->next;
+      free(r->bucks);
+      bloom_destroy(&r->bloom);
+      free(r);
+    } else {
+      pos = &r->next;
+    }
+  }
+}
+
+/**
+ * Migrate entries from old buckets into the new ones under RCU.
+ *
+ * Same as htable_rehash_step(), but the old buckets are retired rather than
+ * freed, as lookups may still be walking them. They are freed by a later
+ * update once a grace period has elapsed, so writers never wait for
+ * readers.
+ *
+ * @param table hash table
+ * @param n number of old buckets to migrate
+ */
+static inline void htable_rehash_step_rcu(struct htable *table, size_t n) {
+  struct hlist_head *old_bucks;
+  struct bloom old_bloom;
+  struct htable_retired *r;
+
+  if (table->retired) {
+    htable_reclaim_rcu(table);
+  }
+
+  if (htable_rehashing(table) && __htable_migrate(table, n, true)) {
+    old_bucks = table->old_bucks;
+    old_bloom = table->old_bloom;
+
+    write_seqcount_begin(&table->seq);
+    __htable_end_rehash(table);
+    write_seqcount_end(&table->seq);
+
+    if ((r = (struct htable_retired *)malloc(sizeof(*r)))) {
+      r->gp = get_state_synchronize_rcu();
+      r->bucks = old_bucks;
+      r->bloom = old_bloom;
+      r->next = table->retired;
+      table->retired = r;
+    } else {
+      // Without memory to track the old buckets, wait for readers instead
+      synchronize_rcu();
+      free(old_bucks);
+      bloom_destroy(&old_bloom);
+    }
+  }
+}
+
+/**
+ * Replace buckets by a new array, the current one becomes the old buckets.
+ */
+static inline int __htable_swap_buckets(struct htable *table, size_t size, bool rcu) {
+  struct hlist_head *bucks;
+  struct bloom bloom;
+
+  if (!(bucks = __htable_alloc_buckets(size))) {
+    return -1;
+  }
+  if (__htable_bloom_init(table, &bloom, size)) {
+    free(bucks);
+    return -1;
+  }
+
+  if (rcu) {
+    write_seqcount_begin(&table->seq);
+  }
+
+  table->old_bloom = table->bloom;
+  table->bloom = bloom;
+  table->old_bucks = table->bucks;
+  table->old_size = table->size;
+  table->rehash_idx = 0;
+  table->bucks = bucks;
+  table->size = size;
+
+  if (rcu) {
+    write_seqcount_end(&table->seq);
+  }
+
+  return 0;
+}
+
+/**
+ * Start migrating table entries into a new array of buckets.
+ *
+ * Any migration already in progress is completed first. The Bloom filter
+ * is resized together with the table and filled as buckets are migrated.
+ *
+ * @param table hash table
+ * @param size new number of buckets, must be power of two
+ */
+static inline int htable_resize(struct htable *table, size_t size) {
+  htable_rehash_step(table, table->old_size);
+  return __htable_swap_buckets(table, size, false);
+}
+
+/**
+ * Start migrating table entries into a new array of buckets under RCU.
+ *
+ * @param table hash table
+ * @param size new number of buckets, must be power of two
+ */
+static inline int htable_resize_rcu(struct htable *table, size_t size) {
+  htable_rehash_step_rcu(table, table->old_size);
+  return __htable_swap_buckets(table, size, true);
+}
+
+/**
+ * Get the number of buckets needed to hold given number of entries.
+ */
+static inline size_t __htable_fit_size(size_t count) {
+  return max_t(size_t, roundup_pow_of_two(max_t(size_t, DIV_ROUND_UP(count, HASH_MAX_LOAD), 1)), HASH_NUM_BUCKETS);
+}
+
+/**
+ * Reserve room for given number of entries.
+ *
+ * Resizes the table once up front, instead of doubling it repeatedly while
+ * the entries are added. Like the size given at initialization, the
+ * reservation is kept when entries are removed, so the table does not
+ * shrink below it automatically.
+ *
+ * @param table hash table
+ * @param n number of entries the table will hold
+ */
+static inline int htable_reserve(struct htable *table, size_t n) {
+  size_t size = __htable_fit_size(n);
+
+  if (size > table->size && htable_resize(table, size)) {
+    return -1;
+  }
+  table->min_size = max_t(size_t, table->min_size, size);
+  return 0;
+}
+
+/**
+ * Shrink the table to the smallest size holding its entries.
+ *
+ * Unlike automatic shrinking, this ignores the size the table was
+ * initialized with or reserved and completes the migration at once, so the memory of
+ * the old buckets is released before returning.
+ *
+ * @param table hash table
+ */
+static inline int htable_compact(struct htable *table) {
+  size_t size = __htable_fit_size(table->count);
+
+  htable_rehash_step(table, table->old_size);
+  if (size < table->size) {
+    if (htable_resize(table, size)) {
+      return -1;
+    }
+    htable_rehash_step(table, table->old_size);
+  }
+  return 0;
+}
+
+/**
+ * Get the number of buckets to shrink to after removing entries, 0 if the
+ * table should keep its size.
+ *
+ * Shrinking leaves the table about half full, far from both thresholds, so
+ * that alternating additions and removals do not resize it back and forth.
+ */
+static inline size_t __htable_shrink_size(const struct htable *table) {
+  if (htable_rehashing(table) || table->size <= table->min_size ||
+      table->count >= (table->size * HASH_MAX_LOAD) >> HASH_SHRINK_SHIFT) {
+    return 0;
+  }
+  return max_t(size_t, __htable_fit_size(table->count * 2), table->min_size);
+}
+
+/*
+ * Comparing keys of common fixed sizes with a few loads avoids calling
+ * memcmp() for every candidate entry. Loads go through memcpy(), which the
+ * compiler turns into a single unaligned load.
+ */
+
+static inline bool __htable_key_eq_4(const void *a, const void *b) {
+  uint32_t x, y;
+
+  memcpy(&x, a, sizeof(x));
+  memcpy(&y, b, sizeof(y));
+  return x == y;
+}
+
+static inline bool __htable_key_eq_8(const void *a, const void *b) {
+  uint64_t x, y;
+
+  memcpy(&x, a, sizeof(x));
+  memcpy(&y, b, sizeof(y));
+  return x == y;
+}
+
+#ifdef __SSE2__
+
+static inline bool __htable_key_eq_16(const void *a, const void *b) {
+  __m128i x = _mm_loadu_si128((const __m128i *)a);
+  __m128i y = _mm_loadu_si128((const __m128i *)b);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+}
+
+static inline bool __htable_key_eq_32(const void *a, const void *b) {
+  __m128i lo = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+  __m128i hi = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a + 1), _mm_loadu_si128((const __m128i *)b + 1));
+  return _mm_movemask_epi8(_mm_and_si128(lo, hi)) == 0xffff;
+}
+
+#else
+
+static inline bool __htable_key_eq_16(const void *a, const void *b) {
+  uint64_t x[2], y[2];
+
+  memcpy(x, a, sizeof(x));
+  memcpy(y, b, sizeof(y));
+  return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
+}
+
+static inline bool __htable_key_eq_32(const void *a, const void *b) {
+  return __htable_key_eq_16(a, b) && __htable_key_eq_16((const uint8_t *)a + 16, (const uint8_t *)b + 16);
+}
+
+#endif
+
+/**
+ * Compare keys of given length, memcmp() being used only for uncommon sizes.
+ */
+static inline bool __htable_key_eq(const void *a, const void *b, size_t len) {
+  switch (len) {
+  case 4:
+    return __htable_key_eq_4(a, b);
+  case 8:
+    return __htable_key_eq_8(a, b);
+  case 16:
+    return __htable_key_eq_16(a, b);
+  case 32:
+    return __htable_key_eq_32(a, b);
+  default:
+    return memcmp(a, b, len) == 0;
+  }
+}
+
+static inline struct htable_entry *__htable_bucket_find(const struct hlist_head *head, const void *key, size_t len, unsigned hash);
+
+/**
+ * Link initialized and hashed entry into its bucket.
+ *
+ * The entry is added to the Bloom filter before it is published, so lookups
+ * under RCU never find it missing from the filter.
+ *
+ * @return true if the table has grown too full
+ */
+static inline bool __htable_link(struct htable *table, struct htable_entry *entry) {
+  unsigned hash = entry->hash;
+  struct hlist_head *head = &table->bucks[htable_which_bucket(table, hash)];
+  struct bloom *bloom = &table->bloom;
+  struct htable_entry *dup = NULL;
+
+  // Join the entries with equal key, wherever they are while rehashing
+  if (table->flags & HTABLE_MULTIMAP) {
+    dup = __htable_bucket_find(head, entry->key, entry->len, hash);
+    if (!dup && htable_rehashing(table)) {
+      size_t buck = hash & (table->old_size - 1);
+      if (buck >= table->rehash_idx) {
+        dup = __htable_bucket_find(&table->old_bucks[buck], entry->key, entry->len, hash);
+        bloom = &table->old_bloom;
+      }
+    }
+  }
+
+  if (dup) {
+    bloom_add(bloom, hash);
+    hlist_add_after_rcu(&dup->node, &entry->node);
+  } else {
+    bloom_add(&table->bloom, hash);
+    hlist_add_head_rcu(&entry->node, head);
+  }
+
+  table->count++;
+
+  return table->count > table->size * HASH_MAX_LOAD && !htable_rehashing(table);
+}
+
+/**
+ * Add an entry whose hash has been computed with the hash function and seed
+ * of the table.
+ */
+static inline void __htable_add_hashed(struct htable *table, struct htable_entry *entry) {
+  htable_rehash_step(table, HASH_REHASH_STEP);
+
+  if (__htable_link(table, entry)) {
+    htable_resize(table, table->size * 2);
+  }
+}
+
+/**
+ * Add a new entry into hash table.
+ *
+ * @param h the hash table to insert entry into
+ * @param e the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void htable_add(struct htable *table, struct htable_entry *entry, void *key, size_t len) {
+  INIT_HTABLE_ENTRY(entry, key, len);
+  entry->hash = __htable_hash(table, key, len);
+  __htable_add_hashed(table, entry);
+}
+
+/**
+ * Add a new entry into hash table looked up under RCU.
+ *
+ * Updates must be serialized by the caller, e.g. by a single writer thread.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void htable_add_rcu(struct htable *table, struct htable_entry *entry, void *key, size_t len) {
+  INIT_HTABLE_ENTRY(entry, key, len);
+  entry->hash = __htable_hash(table, key, len);
+  htable_rehash_step_rcu(table, HASH_REHASH_STEP);
+
+  if (__htable_link(table, entry)) {
+    htable_resize_rcu(table, table->size * 2);
+  }
+}
+
+/**
+ * Looks up a single bucket for the presence of key.
+ *
+ * The cached hash is compared first, so the key of an entry is only
+ * touched when the hash values match.
+ *
+ * @param head the bucket to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key
+ */
+static inline struct htable_entry *__htable_bucket_find(const struct hlist_head *head, const void *key, size_t len, unsigned hash) {
+  struct htable_entry *e;
+  struct hlist_node *n;
+
+  hlist_for_each_entry(e, n, head, node) {
+    if (e->hash == hash && e->len == len && __htable_key_eq(e->key, key, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy short key into the entry.
+ *
+ * @return the key to link the entry with
+ */
+static inline void *__htable_inline_key(struct htable_inline_entry *entry, void *key, size_t len) {
+  if (len <= HTABLE_INLINE_KEY) {
+    memcpy(entry->key, key, len);
+    return entry->key;
+  }
+  return key;
+}
+
+/**
+ * Add a new entry into hash table, storing short keys inline.
+ *
+ * Short keys are copied, so the caller's key need not outlive the entry.
+ * Keys longer than HTABLE_INLINE_KEY bytes are pointed to as by htable_add(),
+ * so they must stay valid and unchanged while the entry is in the table.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the inline hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void htable_add_inline(struct htable *table, struct htable_inline_entry *entry, void *key, size_t len) {
+  htable_add(table, &entry->entry, __htable_inline_key(entry, key, len), len);
+}
+
+/**
+ * Add a new entry into hash table looked up under RCU, storing short keys
+ * inline.
+ *
+ * Keys longer than HTABLE_INLINE_KEY bytes are pointed to, see
+ * htable_add_inline().
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the inline hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void htable_add_inline_rcu(struct htable *table, struct htable_inline_entry *entry, void *key, size_t len) {
+  htable_add_rcu(table, &entry->entry, __htable_inline_key(entry, key, len), len);
+}
+
+/**
+ * Hash keys of entries to be added by htable_build_hashed().
+ *
+ * Writes only to the entries, so disjoint ranges of entries may be hashed
+ * by several threads at once.
+ *
+ * @param table the hash table the entries will be added to
+ * @param entries the entries, their keys set by INIT_HTABLE_ENTRY()
+ * @param n the number of entries
+ */
+static inline void htable_hash_entries(const struct htable *table, struct htable_entry *const entries[], size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    entries[i]->hash = __htable_hash(table, entries[i]->key, entries[i]->len);
+  }
+}
+
+/** Number of partitions entries are first sorted into by htable_build() */
+#define HASH_BUILD_PARTS 1024
+
+/** Entry being sorted by bucket, next to its hash */
+struct __htable_build_item {
+  struct htable_entry *entry;
+  unsigned hash;
+};
+
+/**
+ * Link entries of a bucket in order, after any entry with equal key in
+ * multimap tables.
+ */
+static inline void __htable_build_chain(struct htable *table, struct hlist_head *head, const struct __htable_build_item *items, size_t n) {
+  struct hlist_node **tail = &head->first;
+
+  for (size_t i = 0; i < n; ++i) {
+    struct htable_entry *e = items[i].entry, *dup = NULL;
+
+    bloom_add(&table->bloom, items[i].hash);
+    if (table->flags & HTABLE_MULTIMAP) {
+      dup = __htable_bucket_find(head, e->key, e->len, items[i].hash);
+    }
+
+    if (dup) {
+      hlist_add_after(&dup->node, &e->node);
+      if (!e->node.next) {
+        tail = &e->node.next;
+      }
+    } else {
+      e->node.next = NULL;
+      e->node.pprev = tail;
+      *tail = &e->node;
+      tail = &e->node.next;
+    }
+  }
+}
+
+/**
+ * Stable counting sort of items by key.
+ *
+ * @param offs array of nkeys + 1 zeroed counters, left holding the end of
+ *             each key's range
+ */
+#define __htable_build_sort(dst, src, n, offs, nkeys, key) do { \
+    for (size_t __i = 0; __i < (n); ++__i) { \
+      (offs)[key((src)[__i].hash) + 1]++; \
+    } \
+    for (size_t __k = 1; __k <= (nkeys); ++__k) { \
+      (offs)[__k] += (offs)[__k - 1]; \
+    } \
+    for (size_t __i = 0; __i < (n); ++__i) { \
+      (dst)[(offs)[key((src)[__i].hash)]++] = (src)[__i]; \
+    } \
+  } while (0)
+
+/**
+ * Fill an empty hash table with entries whose keys have been hashed.
+ *
+ * Sizes the table once for all the entries and sorts the entries by bucket
+ * in two passes: first into partitions of consecutive buckets, then by
+ * bucket within each partition, so that the counters of each pass stay in
+ * cache. Each chain is then linked at once, the bucket array being written
+ * in order and entries keeping their relative order within chains. The
+ * table must not be looked up under RCU while it is being built.
+ *
+ * @param table the empty hash table to fill
+ * @param entries the entries, hashed by htable_hash_entries()
+ * @param n the number of entries
+ * @return 0 on success, -1 if the table is not empty or memory is exhausted
+ */
+static inline int htable_build_hashed(struct htable *table, struct htable_entry *const entries[], size_t n) {
+  size_t size = max_t(size_t, __htable_fit_size(n), table->size);
+  struct __htable_build_item *items, *tmp;
+  size_t nparts, per_part, *parts, *offs, start = 0;
+
+  if (table->count) {
+    return -1;
+  }
+  htable_rehash_step(table, table->old_size);
+
+  if (size > table->size) {
+    struct hlist_head *bucks;
+    struct bloom bloom;
+
+    if (!(bucks = __htable_alloc_buckets(size))) {
+      return -1;
+    }
+    if (__htable_bloom_init(table, &bloom, size)) {
+      free(bucks);
+      return -1;
+    }
+    free(table->bucks);
+    bloom_destroy(&table->bloom);
+    table->bucks = bucks;
+    table->bloom = bloom;
+    table->size = size;
+  }
+
+  nparts = min_t(size_t, table->size, HASH_BUILD_PARTS);
+  per_part = table->size / nparts;
+
+  items = (struct __htable_build_item *)malloc(sizeof(*items) * max_t(size_t, n, 1));
+  tmp = (struct __htable_build_item *)malloc(sizeof(*tmp) * max_t(size_t, n, 1));
+  parts = (size_t *)calloc(nparts + 1, sizeof(size_t));
+  offs = (size_t *)malloc(sizeof(size_t) * (per_part + 1));
+  if (!items || !tmp || !parts || !offs) {
+    free(items);
+    free(tmp);
+    free(parts);
+    free(offs);
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    tmp[i].entry = entries[i];
+    tmp[i].hash = entries[i]->hash;
+  }
+
+#define __htable_build_part(hash) (htable_which_bucket(table, hash) / per_part)
+#define __htable_build_bucket(hash) (htable_which_bucket(table, hash) % per_part)
+
+  __htable_build_sort(items, tmp, n, parts, nparts, __htable_build_part);
+
+  for (size_t p = 0; p < nparts; ++p) {
+    size_t end = parts[p], bstart = start;
+
+    memset(offs, 0, sizeof(size_t) * (per_part + 1));
+    __htable_build_sort(&tmp[start], &items[start], end - start, offs, per_part, __htable_build_bucket);
+
+    for (size_t b = 0; b < per_part; ++b) {
+      size_t bend = start + offs[b];
+      __htable_build_chain(table, &table->bucks[p * per_part + b], &tmp[bstart], bend - bstart);
+      bstart = bend;
+    }
+    start = end;
+  }
+
+#undef __htable_build_part
+#undef __htable_build_bucket
+
+  table->count = n;
+
+  free(items);
+  free(tmp);
+  free(parts);
+  free(offs);
+
+  return 0;
+}
+
+/**
+ * Fill an empty hash table with entries.
+ *
+ * Faster than adding the entries one by one, see htable_build_hashed().
+ * To hash the keys in several threads, call htable_hash_entries() from
+ * each and htable_build_hashed() once they are done.
+ *
+ * @param table the empty hash table to fill
+ * @param entries the entries, their keys set by INIT_HTABLE_ENTRY()
+ * @param n the number of entries
+ * @return 0 on success, -1 if the table is not empty or memory is exhausted
+ */
+static inline int htable_build(struct htable *table, struct htable_entry *const entries[], size_t n) {
+  if (table->count) {
+    return -1;
+  }
+  htable_hash_entries(table, entries, n);
+  return htable_build_hashed(table, entries, n);
+}
+
+/**
+ * Function comparing keys of given length.
+ *
+ * Lookups are inlined with a constant comparison function, so that it is
+ * inlined too, see htable_find_<n>().
+ */
+typedef bool (*__htable_key_eq_f)(const void *a, const void *b, size_t len);
+
+/**
+ * Looks up a single bucket of the table, counting probes with HTABLE_STATS.
  */
-static inline void INIT_HTABLE_ENTRY(struct htable_entry *entry, void *key, size_t len) {
-  INIT_HLIST_NODE(&entry->node);
-  entry->key = key;
-  entry->len = len;
+static inline struct htable_entry *__htable_lookup_bucket(const struct htable *table, const struct hlist_head *head, const void *key, size_t len, unsigned hash, __htable_key_eq_f eq) {
+  struct htable_entry *e;
+  struct hlist_node *n;
+
+  (void)table;
+  hlist_for_each_entry(e, n, head, node) {
+    __htable_stat_add(table, probes, 1);
+    if (e->hash == hash && e->len == len && eq(e->key, key, len)) {
+      return e;
+    }
+  }
+  return NULL;
 }
 
 /**
- * Initialize new hash table.
- *
- * @param table hash table
+ * Looks up buckets which have not been migrated yet for the presence of key.
  */
-static inline int htable_init(struct htable *table) {
-  if (!table) {
-    return -1;
+static inline struct htable_entry *__htable_old_find(const struct htable *table, const void *key, size_t len, unsigned hash, __htable_key_eq_f eq) {
+  if (htable_rehashing(table)) {
+    size_t buck = hash & (table->old_size - 1);
+    if (buck >= table->rehash_idx && bloom_test(&table->old_bloom, hash)) {
+      return __htable_lookup_bucket(table, &table->old_bucks[buck], key, len, hash, eq);
+    }
   }
+  return NULL;
+}
 
-  table->size = HASH_NUM_BUCKETS;
-  table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * table->size);
-  assert(table->bucks);
+/**
+ * Looks up the hash table for the presence of key with given hash, computed
+ * with the hash function and seed of the table.
+ */
+static inline struct htable_entry *__htable_find_hashed(const struct htable *h, const void *key, size_t len, unsigned hash, __htable_key_eq_f eq) {
+  struct htable_entry *e = NULL;
 
-  for (int i = 0; i < table->size; ++i) {
-    INIT_HLIST_HEAD(&table->bucks[i]);
+  __htable_stat_add(h, lookups, 1);
+  if (bloom_test(&h->bloom, hash)) {
+    e = __htable_lookup_bucket(h, &h->bucks[htable_which_bucket(h, hash)], key, len, hash, eq);
+  } else {
+    __htable_stat_add(h, bloom_rejects, 1);
   }
+  if (!e) {
+    e = __htable_old_find(h, key, len, hash, eq);
+  }
+  return e;
+}
 
-  table->count = 0;
-  bloom_init(table->bitvect);
-
-  return 0;
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * Lookups do not migrate buckets, so they may be made while iterating over
+ * the table.
+ *
+ * @param h the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct htable_entry *htable_find(const struct htable *h, const void *key, size_t len) {
+  return __htable_find_hashed(h, key, len, __htable_hash(h, key, len), __htable_key_eq);
 }
 
 /**
- * Initialize new table of given size.
+ * Define htable_find_<n>(), looking up keys of n bytes.
  *
- * @param table hash table
- * @param n aproximate size
+ * The key length is known at compile time, so hashing and comparing keys
+ * are specialized for it.
  */
-static inline int htable_init_n(struct htable *table, size_t n) {
-  if (!table) {
-    return -1;
-  }
+#define __HTABLE_DEFINE_FIND_FIXED(n) \
+static inline bool __htable_fixed_key_eq_##n(const void *a, const void *b, size_t len) { \
+  (void)len; \
+  return __htable_key_eq_##n(a, b); \
+} \
+ \
+static inline struct htable_entry *htable_find_##n(const struct htable *table, const void *key) { \
+  return __htable_find_hashed(table, key, n, __htable_hash(table, key, n), __htable_fixed_key_eq_##n); \
+}
 
-  table->size = n > 0 ? n : HASH_BUCKET_THRESH;
-  table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * table->size);
-  assert(table->bucks);
+/* Looks up the hash table for the presence of a key of 4, 8, 16 or 32 bytes */
+__HTABLE_DEFINE_FIND_FIXED(4)
+__HTABLE_DEFINE_FIND_FIXED(8)
+__HTABLE_DEFINE_FIND_FIXED(16)
+__HTABLE_DEFINE_FIND_FIXED(32)
 
-  for (int i = 0; i < table->size; ++i) {
-    INIT_HLIST_HEAD(&table->bucks[i]);
-  }
-  table->count = 0;
-  bloom_init(table->bitvect);
+/**
+ * Get the next entry with the same key in a multimap table.
+ *
+ * @param entry an entry of the table
+ * @return the entry following it if it has the same key, NULL otherwise
+ */
+static inline struct htable_entry *htable_next_dup(const struct htable_entry *entry) {
+  struct htable_entry *next;
 
-  return 0;
+  if (!entry->node.next) {
+    return NULL;
+  }
+  next = hlist_entry(entry->node.next, struct htable_entry, node);
+  if (next->hash == entry->hash && next->len == entry->len &&
+      (next->key == entry->key || __htable_key_eq(next->key, entry->key, entry->len))) {
+    return next;
+  }
+  return NULL;
 }
 
 /**
- * Destroy hash table.
+ * Looks up the multimap hash table for all entries with given key.
  *
- * @param table hash table
+ * Entries with equal keys are linked next to each other in tables created
+ * with HTABLE_MULTIMAP, so they are all found with a single lookup and
+ * walking the run with htable_next_dup(), in no particular order.
+ *
+ * @param table the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param count where to store the number of entries with the key, may be NULL
+ * @return the first entry that matches the key, NULL otherwise
  */
-static inline void htable_destroy(struct htable *table) {
-  if (table && table->bucks) {
-    free(table->bucks);
+static inline struct htable_entry *htable_find_all(const struct htable *table, const void *key, size_t len, size_t *count) {
+  struct htable_entry *first = htable_find(table, key, len);
+
+  if (count) {
+    *count = 0;
+    for (const struct htable_entry *e = first; e; e = htable_next_dup(e)) {
+      ++*count;
+    }
   }
-  bloom_finit(table->bitvect);
+  return first;
 }
 
 /**
- * Add a new entry into hash table.
+ * Looks up the hash table for the presence of several keys.
  *
- * @param h the hash table to insert entry into
- * @param e the hash entry
- * @param key the pointer to entry key
- * @param len the key length
+ * One lookup after another would wait for each cache miss in turn. Instead,
+ * keys are processed in groups: all keys of a group are hashed and their
+ * Bloom filter blocks and buckets prefetched, then the first entries of
+ * their chains are prefetched, and only then the keys are compared, so that
+ * the cache misses of the whole group are served in parallel.
+ *
+ * @param table the hash table to look into
+ * @param keys the keys to look for
+ * @param lens the lengths of the keys
+ * @param n the number of keys
+ * @param out array of n entries to store the entries that match the keys,
+ *            NULL for keys which are not present
+ * @return the number of keys found
  */
-static inline void htable_add(struct htable *table, struct htable_entry *entry, void *key, size_t len) {
-  INIT_HTABLE_ENTRY(entry, key, len);
+static inline size_t htable_find_batch(const struct htable *table, const void *const keys[], const size_t lens[], size_t n, struct htable_entry *out[]) {
+  unsigned hashes[HASH_BATCH_SIZE];
+  struct hlist_head *heads[HASH_BATCH_SIZE];
+  size_t found = 0;
 
-  unsigned hash = jhash(key, len, 0);
-  unsigned buck = htable_which_bucket(table, hash);
-  hlist_add_head(&entry->node, &table->bucks[buck]);
+  for (size_t base = 0; base < n; base += HASH_BATCH_SIZE) {
+    size_t m = min_t(size_t, n - base, HASH_BATCH_SIZE);
 
-  //  struct htable_bucket *bucket = &table->buckets[bucket];
-  //  if (bucket->count > (bucket->expand_mult + 1) * HASH_BUCKET_THRESH && !table->noexpand)
-  //      htable_expand_buckets(table);
+    for (size_t i = 0; i < m; ++i) {
+      hashes[i] = __htable_hash(table, keys[base + i], lens[base + i]);
+      heads[i] = &table->bucks[htable_which_bucket(table, hashes[i])];
+      bloom_prefetch(&table->bloom, hashes[i]);
+      prefetch(heads[i]);
+    }
 
-  bloom_set(table->bitvect, hash);
+    __htable_stat_add(table, lookups, m);
+    for (size_t i = 0; i < m; ++i) {
+      if (!bloom_test(&table->bloom, hashes[i])) {
+        heads[i] = NULL;
+        __htable_stat_add(table, bloom_rejects, 1);
+      } else if (heads[i]->first) {
+        prefetch(hlist_entry(heads[i]->first, struct htable_entry, node));
+      }
+    }
 
-  table->count++;
+    for (size_t i = 0; i < m; ++i) {
+      struct htable_entry *e = NULL;
+
+      if (heads[i]) {
+        e = __htable_lookup_bucket(table, heads[i], keys[base + i], lens[base + i], hashes[i], __htable_key_eq);
+      }
+      if (!e) {
+        e = __htable_old_find(table, keys[base + i], lens[base + i], hashes[i], __htable_key_eq);
+      }
+      out[base + i] = e;
+      found += e != NULL;
+    }
+  }
+  return found;
 }
 
 /**
- * Looks up the hash table for the presence of key.
+ * Looks up a single bucket for the presence of key under RCU.
+ */
+static inline struct htable_entry *__htable_bucket_find_rcu(const struct hlist_head *head, const void *key, size_t len, unsigned hash) {
+  struct htable_entry *e;
+  struct hlist_node *n;
+
+  hlist_for_each_entry_rcu(e, n, head, node) {
+    if (e->hash == hash && e->len == len && __htable_key_eq(e->key, key, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up the hash table for the presence of key under RCU.
  *
- * @param h the hash table to look into
+ * Takes no locks and writes no shared memory, so it may run in any number of
+ * threads concurrently with a writer using the _rcu update functions. The
+ * lookup only retries when it raced with buckets being migrated. The caller
+ * must be a registered RCU thread and may use the entry until its next
+ * quiescent state. The writer must not use the non-RCU update functions
+ * meanwhile, as those free memory without a grace period.
+ *
+ * @param table the hash table to look into
  * @param key the key to look for
  * @param len the length of the key
  * @return a pointer to the entry that matches the key, NULL otherwise
  */
-static inline struct htable_entry *htable_find(const struct htable *h, const void *key, size_t len) {
+static inline struct htable_entry *htable_find_rcu(const struct htable *table, const void *key, size_t len) {
+  unsigned hash = __htable_hash(table, key, len);
   struct htable_entry *e;
-  struct hlist_node *n;
 
-  unsigned hash = jhash(key, len, 0);
-  unsigned buck = htable_which_bucket(h, hash);
+  for (;;) {
+    unsigned seq = read_seqcount_begin(&table->seq);
+    struct hlist_head *bucks = ACCESS_ONCE(table->bucks);
+    size_t size = ACCESS_ONCE(table->size);
+    struct hlist_head *old_bucks = ACCESS_ONCE(table->old_bucks);
+    size_t old_size = ACCESS_ONCE(table->old_size);
+    size_t rehash_idx = ACCESS_ONCE(table->rehash_idx);
+    struct bloom bloom = table->bloom;
+    struct bloom old_bloom = table->old_bloom;
 
-  if (bloom_test(h->bitvect, hash)) {
-    if (!hlist_empty(&h->bucks[buck])) {
-      hlist_for_each_entry(e, n, &h->bucks[buck], node) {
-        if (e->len == len && memcmp(e->key, key, len) == 0) {
-          return e;
+    // Bucket arrays and their sizes may be inconsistent while being replaced
+    if (read_seqcount_retry(&table->seq, seq)) {
+      continue;
+    }
+
+    e = NULL;
+    if (bloom_test(&bloom, hash)) {
+      e = __htable_bucket_find_rcu(&bucks[hash & (size - 1)], key, len, hash);
+    }
+    if (!e && old_bucks) {
+      size_t buck = hash & (old_size - 1);
+      if (buck >= rehash_idx && bloom_test(&old_bloom, hash)) {
+        e = __htable_bucket_find_rcu(&old_bucks[buck], key, len, hash);
+      }
+    }
+
+    // An entry might have been missed while it was being migrated
+    if (e || !read_seqcount_retry(&table->seq, seq)) {
+      return e;
+    }
+  }
+}
+
+/**
+ * Tests whether entry is in a bucket which has not been migrated yet.
+ */
+static inline bool __htable_entry_in_old(const struct htable *table, const struct htable_entry *entry) {
+  struct htable_entry *e;
+  struct hlist_node *n;
+
+  if (htable_rehashing(table)) {
+    size_t buck = entry->hash & (table->old_size - 1);
+    if (buck >= table->rehash_idx) {
+      hlist_for_each_entry(e, n, &table->old_bucks[buck], node) {
+        if (e == entry) {
+          return true;
         }
       }
     }
   }
-  return NULL;
+  return false;
 }
 
+/**
+ * Unlink entry from its bucket, clearing it from counting Bloom filter.
+ *
+ * @param rcu whether lookups may be running under RCU
+ */
+static inline void __htable_unlink(struct htable *table, struct htable_entry *entry, bool rcu) {
+  if (table->flags & HTABLE_BLOOM_COUNTING) {
+    bloom_del(__htable_entry_in_old(table, entry) ? &table->old_bloom : &table->bloom, entry->hash);
+  }
+  if (rcu) {
+    hlist_del_rcu(&entry->node);
+  } else {
+    hlist_del_init(&entry->node);
+  }
+  table->count--;
+}
+
+/**
+ * Remove entry with given key from hash table.
+ *
+ * Starts shrinking the table once it has become mostly empty, though never
+ * below the size it was initialized with.
+ *
+ * @param table the hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
 static inline struct htable_entry *htable_del_key(struct htable *table, const void *key, size_t len) {
   struct htable_entry *entry;
 
+  htable_rehash_step(table, HASH_REHASH_STEP);
+
   if ((entry = htable_find(table, key, len))) {
-    hlist_del_init(&entry->node);
-    table->count--;
+    size_t size;
+
+    __htable_unlink(table, entry, false);
+    if ((size = __htable_shrink_size(table))) {
+      htable_resize(table, size);
+    }
+
+    return entry;
+  }
+  return NULL;
+}
+
+/**
+ * Remove entry with given key from hash table looked up under RCU.
+ *
+ * The removed entry must not be freed or reused until a grace period has
+ * elapsed, see synchronize_rcu().
+ *
+ * @param table the hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct htable_entry *htable_del_key_rcu(struct htable *table, const void *key, size_t len) {
+  struct htable_entry *entry;
+
+  htable_rehash_step_rcu(table, HASH_REHASH_STEP);
+
+  if ((entry = htable_find_rcu(table, key, len))) {
+    size_t size;
+
+    __htable_unlink(table, entry, true);
+    if ((size = __htable_shrink_size(table))) {
+      htable_resize_rcu(table, size);
+    }
 
     return entry;
   }
   return NULL;
 }
 
+/**
+ * Remove given entry from hash table.
+ *
+ * Unlike the other operations, this never migrates buckets nor shrinks the
+ * table, so it is safe to use while iterating over the table.
+ *
+ * @param table the hash table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
 static inline struct htable_entry *htable_del_entry(struct htable *table, struct htable_entry *entry) {
-  return htable_del_key(table, entry->key, entry->len);
+  if (hlist_unhashed(&entry->node)) {
+    return NULL;
+  }
+
+  __htable_unlink(table, entry, false);
+
+  return entry;
+}
+
+/**
+ * Remove given entry from hash table looked up under RCU.
+ *
+ * The removed entry must not be freed or reused until a grace period has
+ * elapsed, see synchronize_rcu().
+ *
+ * @param table the hash table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct htable_entry *htable_del_entry_rcu(struct htable *table, struct htable_entry *entry) {
+  if (hlist_unhashed(&entry->node)) {
+    return NULL;
+  }
+
+  __htable_unlink(table, entry, true);
+
+  return entry;
 }
 
 /**
@@ -243,6 +1420,72 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
     struct htable_entry *e = htable_find((table), (key), (len)); \
     (type *)(e ? hash_entry(e, type, member) : NULL); })
 
+/**
+ * Looks up the hash table for the presence of key under RCU.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define hash_find_entry_rcu(table, key, len, type, member) ({ \
+    struct htable_entry *e = htable_find_rcu((table), (key), (len)); \
+    (type *)(e ? hash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over entries with the same key in a multimap table.
+ *
+ * @param pos struct htable entry to use as a loop cursor
+ * @param first the first entry with the key, see htable_find_all()
+ */
+#define htable_for_each_dup(pos, first) \
+  for (pos = (first); pos; pos = htable_next_dup(pos))
+
+/**
+ * Iterate over entries with the same key in a multimap table safe against
+ * removal of table entry by htable_del_entry().
+ *
+ * @param pos struct htable entry to use as a loop cursor
+ * @param n another struct htable entry to use as temporary storage
+ * @param first the first entry with the key, see htable_find_all()
+ */
+#define htable_for_each_dup_safe(pos, n, first) \
+  for (pos = (first); pos && ({ n = htable_next_dup(pos); 1; }); pos = n)
+
+/**
+ * Iterate over elements of given type with the same key in a multimap table.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param first the first entry with the key, see htable_find_all()
+ * @param member the name of the enry within the struct
+ */
+#define htable_for_each_dup_entry(tpos, pos, first, member) \
+  for (pos = (first); pos && ({ tpos = hash_entry(pos, typeof(*tpos), member); 1;}); \
+       pos = htable_next_dup(pos))
+
+/**
+ * Looks up the hash table for the presence of key, for user data embedding
+ * struct htable_inline_entry.
+ *
+ * @param member the name of the inline entry within the struct
+ */
+#define hash_find_inline_entry(table, key, len, type, member) \
+  hash_find_entry(table, key, len, type, member.entry)
+
+/**
+ * Get bucket by index, counting buckets being migrated after the current ones.
+ *
+ * @param table hash table
+ * @param i bucket index
+ */
+#define htable_bucket_at(table, i) \
+  ((i) < (table)->size ? &(table)->bucks[i] : &(table)->old_bucks[(i) - (table)->size])
+
+/*
+ * The iterators visit both bucket arrays while the table is being resized.
+ * Adding or deleting entries by key migrates buckets, so only lookups and
+ * htable_del_entry() may be used while iterating. Use htable_scan() to
+ * iterate in steps while the table is updated in between.
+ */
+
 /**
  * Iterate over hash table elements.
  *
@@ -250,8 +1493,8 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param table your table
  */
 #define htable_for_each(pos, table) \
-  for (int i = 0; i < (table)->size; ++i) \
-    for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
+  for (size_t i = 0; i < (table)->size + (table)->old_size; ++i) \
+    for (pos = hlist_entry(htable_bucket_at(table, i)->first, typeof(*pos), node); \
          pos; pos = hlist_entry(pos->node.next, typeof(*pos), node))
 
 /**
@@ -262,8 +1505,8 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param table your table
  */
 #define htable_for_each_safe(pos, n, table) \
-  for (int i = 0; i < (table)->size; ++i) \
-    for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
+  for (size_t i = 0; i < (table)->size + (table)->old_size; ++i) \
+    for (pos = hlist_entry(htable_bucket_at(table, i)->first, typeof(*pos), node); \
          pos && ({ n = hlist_entry(pos->node.next, typeof(*pos), node); 1; }); \
          pos = n)
 
@@ -276,8 +1519,8 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param member the name of the enry within the struct
  */
 #define htable_for_each_entry(tpos, pos, table, member) \
-  for (int i = 0; i < (table)->size; ++i) \
-    for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
+  for (size_t i = 0; i < (table)->size + (table)->old_size; ++i) \
+    for (pos = hlist_entry(htable_bucket_at(table, i)->first, typeof(*pos), node); \
          pos && ({ tpos = hash_entry(pos, typeof(*tpos), member); 1;}); \
          pos = hlist_entry(pos->node.next, typeof(*pos), node))
 
@@ -290,9 +1533,189 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param member the name of the enry within the struct
  */
 #define htable_for_each_entry_safe(tpos, pos, n, table, member) \
-  for (int i = 0; i < (table)->size; ++i) \
-    for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
+  for (size_t i = 0; i < (table)->size + (table)->old_size; ++i) \
+    for (pos = hlist_entry(htable_bucket_at(table, i)->first, typeof(*pos), node); \
          pos && ({ n = hlist_entry(pos->node.next, typeof(*pos), node); 1; }) && ({ tpos = hash_entry(pos, typeof(*tpos), member); 1;}); \
          pos = n)
 
+/**
+ * Function called for each entry visited by htable_scan().
+ *
+ * @param entry the visited entry
+ * @param arg the argument passed to htable_scan()
+ */
+typedef void (*htable_scan_f)(struct htable_entry *entry, void *arg);
+
+/**
+ * Visit all entries of a bucket.
+ *
+ * @return the number of entries visited
+ */
+static inline size_t __htable_scan_bucket(struct hlist_head *head, htable_scan_f fn, void *arg) {
+  struct hlist_node *pos, *tmp;
+  size_t n = 0;
+
+  hlist_for_each_safe(pos, tmp, head) {
+    fn(hlist_entry(pos, struct htable_entry, node), arg);
+    n++;
+  }
+  return n;
+}
+
+/**
+ * Advance scan cursor to the next bucket in reverse binary order.
+ *
+ * The bits above the mask are set, so that incrementing the reversed cursor
+ * carries into the bits that index the buckets.
+ */
+static inline unsigned long __htable_scan_next(unsigned long cursor, unsigned long mask) {
+  cursor |= ~mask;
+  cursor = bitrev_long(cursor);
+  cursor++;
+  return bitrev_long(cursor);
+}
+
+/**
+ * Visit entries of the table in bounded steps.
+ *
+ * Start with cursor 0 and pass the returned cursor to the next call, until
+ * 0 is returned. Each call visits whole buckets until at least count
+ * entries have been visited or the scan is complete, so the scan can be
+ * spread over time while the table is used in between.
+ *
+ * Buckets are visited in the order of their index with bits reversed. The
+ * entries of a bucket are split only between buckets which share the low
+ * bits of its index when the table grows, and gathered from them when it
+ * shrinks, so buckets visited before a resize map to buckets whose index
+ * precedes the cursor in this order afterwards. Thus every entry present
+ * during the whole scan is visited, even if the table is resized between
+ * calls. Entries may be visited twice only if the table shrinks.
+ *
+ * The function may remove the visited entry with htable_del_entry(), but
+ * must not modify the table otherwise.
+ *
+ * @param table the hash table
+ * @param cursor the cursor returned by the previous call, 0 to start
+ * @param count the number of entries to visit
+ * @param fn the function to call for each entry
+ * @param arg the argument to pass to the function
+ * @return the cursor to resume the scan from, 0 once all buckets were visited
+ */
+static inline unsigned long htable_scan(struct htable *table, unsigned long cursor, size_t count, htable_scan_f fn, void *arg) {
+  size_t visited = 0;
+
+  do {
+    if (!htable_rehashing(table)) {
+      unsigned long mask = table->size - 1;
+
+      visited += __htable_scan_bucket(&table->bucks[cursor & mask], fn, arg);
+      cursor = __htable_scan_next(cursor, mask);
+    } else {
+      struct hlist_head *small = table->bucks, *large = table->old_bucks;
+      unsigned long small_mask = table->size - 1, large_mask = table->old_size - 1;
+
+      if (small_mask > large_mask) {
+        swap(small, large);
+        swap(small_mask, large_mask);
+      }
+
+      visited += __htable_scan_bucket(&small[cursor & small_mask], fn, arg);
+
+      // Visit the buckets of the larger array which the smaller bucket expands to
+      do {
+        visited += __htable_scan_bucket(&large[cursor & large_mask], fn, arg);
+        cursor = __htable_scan_next(cursor, large_mask);
+      } while (cursor & (small_mask ^ large_mask));
+    }
+  } while (cursor && visited < count);
+
+  return cursor;
+}
+
+/** Number of chain lengths told apart by htable_stats(), longer chains share the last one */
+#define HTABLE_STATS_CHAINS 16
+
+/** Hash table statistics */
+struct htable_stats {
+  /** Number of entries */
+  size_t count;
+  /** Number of buckets, including those not migrated yet */
+  size_t buckets;
+  /** Average number of entries per bucket */
+  double load_factor;
+  /** Number of empty buckets */
+  size_t empty_buckets;
+  /** Length of the longest chain */
+  size_t max_chain;
+  /** Average length of non-empty chains */
+  double mean_chain;
+  /** Number of buckets by length of their chain */
+  size_t chains[HTABLE_STATS_CHAINS];
+  /** Fraction of Bloom filter bits set */
+  double bloom_saturation;
+  /** Estimated false positive rate of Bloom filter */
+  double bloom_fp_rate;
+  /** Number of lookups, zero unless counted with HTABLE_STATS */
+  size_t lookups;
+  /** Average number of entries compared by lookups */
+  double probes_per_lookup;
+  /** Fraction of lookups rejected by Bloom filter */
+  double bloom_reject_rate;
+};
+
+/**
+ * Add chains of an array of buckets to statistics.
+ */
+static inline void __htable_stats_chains(struct htable_stats *stats, const struct hlist_head *bucks, size_t start, size_t end) {
+  for (size_t i = start; i < end; ++i) {
+    const struct hlist_node *n;
+    size_t len = 0;
+
+    hlist_for_each(n, &bucks[i]) {
+      len++;
+    }
+
+    stats->buckets++;
+    stats->chains[min_t(size_t, len, HTABLE_STATS_CHAINS - 1)]++;
+    stats->max_chain = max_t(size_t, stats->max_chain, len);
+    if (!len) {
+      stats->empty_buckets++;
+    }
+  }
+}
+
+/**
+ * Collect statistics of hash table.
+ *
+ * Walks all buckets, so it takes time proportional to the table size. The
+ * lookup counters are only kept with HTABLE_STATS, which restricts lookups
+ * to one thread at a time.
+ *
+ * @param table hash table
+ * @param stats statistics to fill in
+ */
+static inline void htable_stats(const struct htable *table, struct htable_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  stats->count = table->count;
+  stats->load_factor = (double)table->count / table->size;
+
+  __htable_stats_chains(stats, table->bucks, 0, table->size);
+  if (htable_rehashing(table)) {
+    __htable_stats_chains(stats, table->old_bucks, table->rehash_idx, table->old_size);
+  }
+  if (stats->buckets > stats->empty_buckets) {
+    stats->mean_chain = (double)table->count / (stats->buckets - stats->empty_buckets);
+  }
+
+  stats->bloom_saturation = bloom_saturation(&table->bloom);
+  stats->bloom_fp_rate = bloom_fp_rate(&table->bloom);
+
+  stats->lookups = table->lookups;
+  if (table->lookups) {
+    stats->probes_per_lookup = (double)table->probes / table->lookups;
+    stats->bloom_reject_rate = (double)table->bloom_rejects / table->lookups;
+  }
+}
+
 #endif // HTABLE_H_
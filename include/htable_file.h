@@ -0,0 +1,195 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTABLE_FILE_H_
+#define HTABLE_FILE_H_
+
+#include "htable.h"
+#include "jhash.h"
+#include "kernel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Immutable hash table stored in a file.
+ *
+ * The file is built once from a struct htable and then mapped into memory,
+ * so opening it takes constant time whatever the number of entries. It
+ * contains no pointers, only offsets from the start of the file, and can be
+ * mapped at any address.
+ *
+ * The file starts with a header, followed by an array of size + 1 offsets:
+ * entries of bucket i are stored one after another between offsets i and
+ * i + 1. Each entry consists of its hash, key length and value length,
+ * followed by the key and the value, each padded to 8 bytes so that values
+ * are suitably aligned to hold structs. Keys are hashed with jhash() using
+ * the seed stored in the header.
+ *
+ * Numbers are stored in the byte order of the machine which built the
+ * file; files with the other byte order are rejected. Files are trusted:
+ * only the header is checked on opening.
+ */
+
+/** Magic number at the start of the file */
+#define HTABLE_FILE_MAGIC 0x4c4b4854U
+/** Version of the file format */
+#define HTABLE_FILE_VERSION 1
+/** Alignment of keys and values in the file */
+#define HTABLE_FILE_ALIGN 8
+
+/** File header */
+struct htable_file_header {
+  /** HTABLE_FILE_MAGIC */
+  uint32_t magic;
+  /** HTABLE_FILE_VERSION */
+  uint32_t version;
+  /** Seed of the hash function */
+  uint32_t seed;
+  /** Reserved, zero */
+  uint32_t reserved;
+  /** Number of buckets, power of two */
+  uint64_t size;
+  /** Number of entries */
+  uint64_t count;
+  /** Offset of the bucket offsets */
+  uint64_t bucks;
+  /** Length of the file */
+  uint64_t len;
+};
+
+/** Entry stored in the file */
+struct htable_file_entry {
+  /** Hash of the key */
+  uint32_t hash;
+  /** Length of the key */
+  uint32_t keylen;
+  /** Length of the value */
+  uint32_t vallen;
+  /** Reserved, zero */
+  uint32_t reserved;
+  /** Key followed by value, each padded to HTABLE_FILE_ALIGN */
+  uint8_t data[];
+};
+
+/** Hash table file mapped into memory */
+struct htable_file {
+  /** Start of the mapping */
+  const uint8_t *base;
+  /** Length of the mapping */
+  size_t len;
+  /** Bucket offsets */
+  const uint64_t *bucks;
+  /** Number of buckets */
+  size_t size;
+  /** Seed of the hash function */
+  uint32_t seed;
+};
+
+/**
+ * Get the value to store with an entry.
+ *
+ * @param entry the table entry
+ * @param len where to store the length of the value
+ * @param arg the argument passed to htable_file_build()
+ * @return the value, NULL for an empty value
+ */
+typedef const void *(*htable_file_value_f)(const struct htable_entry *entry, size_t *len, void *arg);
+
+/**
+ * Write the entries of a hash table into a file.
+ *
+ * The file is written under a temporary name and renamed into place, so
+ * that readers never map a partially written file.
+ *
+ * @param table the hash table to write
+ * @param path the path of the file
+ * @param fn the function returning the value of each entry, NULL to store keys only
+ * @param arg the argument to pass to the function
+ * @return 0 on success, -1 on error with errno set
+ */
+extern int htable_file_build(const struct htable *table, const char *path, htable_file_value_f fn, void *arg);
+
+/**
+ * Map hash table file into memory.
+ *
+ * @param file the hash table file
+ * @param path the path of the file
+ * @return 0 on success, -1 on error with errno set
+ */
+extern int htable_file_open(struct htable_file *file, const char *path);
+
+/**
+ * Unmap hash table file.
+ *
+ * @param file the hash table file
+ */
+extern void htable_file_close(struct htable_file *file);
+
+/**
+ * Get the number of entries in the file.
+ */
+#define htable_file_count(file) \
+  (((const struct htable_file_header *)(file)->base)->count)
+
+/**
+ * Get the key of a file entry.
+ */
+static inline const void *htable_file_key(const struct htable_file_entry *entry) {
+  return entry->data;
+}
+
+/**
+ * Get the value of a file entry.
+ */
+static inline const void *htable_file_value(const struct htable_file_entry *entry) {
+  return entry->data + ALIGN(entry->keylen, HTABLE_FILE_ALIGN);
+}
+
+/**
+ * Get the size of a file entry including padding.
+ */
+static inline size_t __htable_file_entry_size(uint32_t keylen, uint32_t vallen) {
+  return sizeof(struct htable_file_entry) + ALIGN(keylen, HTABLE_FILE_ALIGN) + ALIGN(vallen, HTABLE_FILE_ALIGN);
+}
+
+/**
+ * Looks up the hash table file for the presence of key.
+ *
+ * @param file the hash table file to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline const struct htable_file_entry *htable_file_find(const struct htable_file *file, const void *key, size_t len) {
+  uint32_t hash = jhash(key, len, file->seed);
+  size_t buck = hash & (file->size - 1);
+  uint64_t end = file->bucks[buck + 1];
+
+  for (uint64_t off = file->bucks[buck]; off < end;) {
+    const struct htable_file_entry *e = (const struct htable_file_entry *)(file->base + off);
+
+    if (e->hash == hash && e->keylen == len && memcmp(e->data, key, len) == 0) {
+      return e;
+    }
+    off += __htable_file_entry_size(e->keylen, e->vallen);
+  }
+  return NULL;
+}
+
+#endif // HTABLE_FILE_H_
@@ -0,0 +1,261 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IHTABLE_H_
+#define IHTABLE_H_
+
+#include "hash.h"
+#include "hlist.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Hash table keyed by 64-bit integers.
+ *
+ * The key is stored inline in the entry and hashed with hash_64(), whose
+ * result directly selects the bucket; comparing keys is a single integer
+ * comparison. There is no key pointer to follow and no cached hash, so an
+ * entry is only a list node and the key.
+ */
+
+/** Default number of buckets */
+#define IHASH_NUM_BUCKETS 16
+/** Expand when average number of entries per bucket exceeds threshold */
+#define IHASH_MAX_LOAD 1
+
+/** Integer-keyed hash table entry */
+struct ihtable_entry {
+  /** Linked list node */
+  struct hlist_node node;
+  /** Key of the entry */
+  uint64_t key;
+};
+
+/** Integer-keyed hash table */
+struct ihtable {
+  /** Buckets containing table elements */
+  struct hlist_head *bucks;
+  /** Number of allocated buckets, 2^bits */
+  size_t size;
+  /** Number of hash bits selecting a bucket */
+  unsigned bits;
+  /** Number of entries in the table */
+  size_t count;
+};
+
+#define ihtable_bucket(table, key) (&(table)->bucks[hash_64((key), (table)->bits)])
+
+/**
+ * Initialize new integer-keyed table of given size.
+ *
+ * @param table integer-keyed hash table
+ * @param n aproximate size, rounded up to power of two
+ */
+static inline int ihtable_init_n(struct ihtable *table, size_t n) {
+  if (!table) {
+    return -1;
+  }
+
+  // hash_64() cannot produce zero bits
+  table->size = n > 1 ? roundup_pow_of_two(n) : IHASH_NUM_BUCKETS;
+  table->bits = ilog2(table->size);
+  table->count = 0;
+  table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * table->size);
+  assert(table->bucks);
+
+  for (size_t i = 0; i < table->size; ++i) {
+    INIT_HLIST_HEAD(&table->bucks[i]);
+  }
+
+  return 0;
+}
+
+/**
+ * Initialize new integer-keyed table.
+ *
+ * @param table integer-keyed hash table
+ */
+static inline int ihtable_init(struct ihtable *table) {
+  return ihtable_init_n(table, IHASH_NUM_BUCKETS);
+}
+
+/**
+ * Destroy integer-keyed table.
+ *
+ * @param table integer-keyed hash table
+ */
+static inline void ihtable_destroy(struct ihtable *table) {
+  if (!table) {
+    return;
+  }
+  free(table->bucks);
+}
+
+/**
+ * Move all entries into a new array of buckets.
+ *
+ * Rehashing an integer key costs a multiplication, so unlike htable the
+ * entries are moved at once.
+ *
+ * @param table integer-keyed hash table
+ * @param size new number of buckets, must be power of two greater than one
+ */
+static inline int ihtable_resize(struct ihtable *table, size_t size) {
+  struct hlist_head *bucks = table->bucks;
+  size_t old_size = table->size;
+  struct hlist_node *pos, *tmp;
+
+  if (!(table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * size))) {
+    table->bucks = bucks;
+    return -1;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    INIT_HLIST_HEAD(&table->bucks[i]);
+  }
+  table->size = size;
+  table->bits = ilog2(size);
+
+  for (size_t i = 0; i < old_size; ++i) {
+    hlist_for_each_safe(pos, tmp, &bucks[i]) {
+      struct ihtable_entry *e = hlist_entry(pos, struct ihtable_entry, node);
+      hlist_add_head(pos, ihtable_bucket(table, e->key));
+    }
+  }
+  free(bucks);
+
+  return 0;
+}
+
+/**
+ * Add a new entry into integer-keyed table.
+ *
+ * @param table the table to insert entry into
+ * @param entry the hash entry
+ * @param key the entry key
+ */
+static inline void ihtable_add(struct ihtable *table, struct ihtable_entry *entry, uint64_t key) {
+  entry->key = key;
+  hlist_add_head(&entry->node, ihtable_bucket(table, key));
+
+  if (++table->count > table->size * IHASH_MAX_LOAD) {
+    ihtable_resize(table, table->size * 2);
+  }
+}
+
+/**
+ * Looks up the integer-keyed table for the presence of key.
+ *
+ * @param table the table to look into
+ * @param key the key to look for
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct ihtable_entry *ihtable_find(const struct ihtable *table, uint64_t key) {
+  struct ihtable_entry *e;
+  struct hlist_node *n;
+
+  hlist_for_each_entry(e, n, ihtable_bucket(table, key), node) {
+    if (e->key == key) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Remove given entry from integer-keyed table.
+ *
+ * @param table the table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct ihtable_entry *ihtable_del_entry(struct ihtable *table, struct ihtable_entry *entry) {
+  if (hlist_unhashed(&entry->node)) {
+    return NULL;
+  }
+
+  hlist_del_init(&entry->node);
+  table->count--;
+
+  return entry;
+}
+
+/**
+ * Remove entry with given key from integer-keyed table.
+ *
+ * @param table the table
+ * @param key the key to look for
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct ihtable_entry *ihtable_del_key(struct ihtable *table, uint64_t key) {
+  struct ihtable_entry *entry;
+
+  if ((entry = ihtable_find(table, key))) {
+    ihtable_del_entry(table, entry);
+  }
+  return entry;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the entry pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define ihash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the integer-keyed table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define ihash_find_entry(table, key, type, member) ({ \
+    struct ihtable_entry *e = ihtable_find((table), (key)); \
+    (type *)(e ? ihash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over integer-keyed table elements of given type.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos struct hlist_node pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the entry within the struct
+ */
+#define ihtable_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    hlist_for_each_entry(tpos, pos, &(table)->bucks[i], member.node)
+
+/**
+ * Iterate over integer-keyed table elements of given type safe against removal
+ * of table entry.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos struct hlist_node pointer to use as a loop cursor
+ * @param n another struct hlist_node pointer to use as temporary storage
+ * @param table your table
+ * @param member the name of the entry within the struct
+ */
+#define ihtable_for_each_entry_safe(tpos, pos, n, table, member) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    hlist_for_each_entry_safe(tpos, pos, n, &(table)->bucks[i], member.node)
+
+#endif // IHTABLE_H_
@@ -0,0 +1,86 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTERVAL_TREE_H_
+#define INTERVAL_TREE_H_
+
+#include "kernel.h"
+#include "rbtree.h"
+
+/*
+ * Interval tree.
+ *
+ * Red black tree of closed intervals [start, last] sorted by start, where
+ * each node also keeps the greatest last of its subtree, maintained by the
+ * rb_augment_* functions. Subtrees ending before a query interval are
+ * skipped, so finding all k intervals overlapping it takes O(log n + k).
+ * Several intervals may have the same start.
+ */
+
+/** Interval tree node */
+struct interval_tree_node {
+    struct rb_node rb;
+    /** First point of the interval */
+    unsigned long start;
+    /** Last point of the interval, inclusive */
+    unsigned long last;
+    /** Greatest last of the subtree rooted at this node */
+    unsigned long __subtree_last;
+};
+
+/* Externals are commented with implementation */
+extern void interval_tree_insert(struct interval_tree_node *node, struct rb_root *root);
+extern void interval_tree_remove(struct interval_tree_node *node, struct rb_root *root);
+
+extern struct interval_tree_node *interval_tree_iter_first(struct rb_root *root,
+        unsigned long start, unsigned long last);
+extern struct interval_tree_node *interval_tree_iter_next(struct interval_tree_node *node,
+        unsigned long start, unsigned long last);
+
+/**
+ * Get the struct for this entry.
+ *
+ * @param ptr struct interval_tree_node pointer
+ * @param type type of the struct this is embedded in
+ * @param member name of the interval tree node within the struct
+ */
+#define interval_tree_entry(ptr, type, member) \
+    container_of(ptr, type, member)
+
+/**
+ * Iterate over intervals overlapping [start, last], in order of start.
+ *
+ * @param pos struct interval_tree_node to use as a loop cursor
+ * @param root root of your tree
+ * @param start first point of the query interval
+ * @param last last point of the query interval, inclusive
+ */
+#define interval_tree_for_each_overlap(pos, root, start, last) \
+    for (pos = interval_tree_iter_first(root, start, last); pos; \
+         pos = interval_tree_iter_next(pos, start, last))
+
+/**
+ * Iterate over intervals containing a point, in order of start.
+ *
+ * @param pos struct interval_tree_node to use as a loop cursor
+ * @param root root of your tree
+ * @param point the point to stab the intervals with
+ */
+#define interval_tree_for_each_stab(pos, root, point) \
+    interval_tree_for_each_overlap(pos, root, point, point)
+
+#endif // INTERVAL_TREE_H_
@@ -158,7 +158,7 @@ static inline __attribute__((const)) unsigned long __rounddown_pow_of_two(unsign
  */
 #define roundup_pow_of_two(n) ( \
         __builtin_constant_p(n) ? ( \
-            (n == 1) ? 1 : (1UL << (ilog2((n) - 1) + 1)) \
+            ((n) == 1) ? 1 : (1UL << (ilog2((n) - 1) + 1)) \
             ) : __roundup_pow_of_two(n) \
     )
 
@@ -36,6 +36,21 @@ struct rb_root {
     struct rb_node *rb_node;
 };
 
+/**
+ * Red Black tree root caching the first and last nodes.
+ *
+ * Finding the first or last node takes constant time instead of walking
+ * down the tree, e.g. for priority queues. The tree must only be modified
+ * through the _cached functions.
+ */
+struct rb_root_cached {
+    struct rb_root rb_root;
+    /** First node in sort order, NULL for an empty tree */
+    struct rb_node *rb_leftmost;
+    /** Last node in sort order, NULL for an empty tree */
+    struct rb_node *rb_rightmost;
+};
+
 #define rb_parent(r) ((struct rb_node *)((r)->rb_parent_color & ~3))
 #define rb_color(r) ((r)->rb_parent_color & 1)
 #define rb_is_red(r) (!rb_color(r))
@@ -64,6 +79,7 @@ static inline void rb_set_color(struct rb_node *node, int color) {
 }
 
 #define RB_ROOT (struct rb_root) { NULL, }
+#define RB_ROOT_CACHED (struct rb_root_cached) { { NULL, }, NULL, NULL }
 
 #define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
 #define RB_EMPTY_NODE(node) (rb_parent(node) == node)
@@ -97,6 +113,19 @@ extern struct rb_node *rb_first(struct rb_root *root);
 extern struct rb_node *rb_last(struct rb_root *root);
 
 extern void rb_replace_node(struct rb_node *victim, struct rb_node *new,  struct rb_root *root);
+extern void rb_build_sorted(struct rb_root *root, struct rb_node **nodes, size_t n);
+extern void rb_join(struct rb_root *left, struct rb_node *pivot, struct rb_root *right);
+extern void rb_split_at(struct rb_root *root, struct rb_node *node, struct rb_root *right);
+
+extern void rb_insert_color_cached(struct rb_node *node, struct rb_root_cached *root);
+extern void rb_erase_cached(struct rb_node *node, struct rb_root_cached *root);
+extern void rb_replace_node_cached(struct rb_node *victim, struct rb_node *new, struct rb_root_cached *root);
+extern struct rb_node *rb_pop_first_cached(struct rb_root_cached *root);
+
+/** First node of tree with cached root, in constant time */
+#define rb_first_cached(root) ((root)->rb_leftmost)
+/** Last node of tree with cached root, in constant time */
+#define rb_last_cached(root) ((root)->rb_rightmost)
 
 /**
  * Link node with given node in red black tree.
@@ -136,7 +165,7 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
  */
 #define rb_find(root, type, member, key, value, cmp) ({ \
         bool found = false; \
-        struct rb_node *node = root->rb_node; \
+        struct rb_node *node = (root)->rb_node; \
         while (node) { \
             int result = cmp(rb_entry(node, type, member)->key, value); \
             if (result < 0) { \
@@ -163,7 +192,7 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
  */
 #define rb_insert(root, type, member, key, item, cmp) ({ \
         bool insert = true; \
-        struct rb_node **new = &(root->rb_node), *parent = NULL; \
+        struct rb_node **new = &((root)->rb_node), *parent = NULL; \
         while (*new) { \
             int result = cmp(rb_entry(*new, type, member)->key, \
                 rb_entry(item, type, member)->key); \
@@ -183,6 +212,38 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
         } \
     })
 
+/**
+ * Add node to red black tree with cached root.
+ *
+ * @param root cached tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the list structure within the struct
+ * @param key name of the key item within the struct
+ * @param item item to insert into the tree
+ * @param cmp comparison function
+ */
+#define rb_insert_cached(root, type, member, key, item, cmp) ({ \
+        bool insert = true; \
+        struct rb_node **new = &((root)->rb_root.rb_node), *parent = NULL; \
+        while (*new) { \
+            int result = cmp(rb_entry(*new, type, member)->key, \
+                rb_entry(item, type, member)->key); \
+            parent = *new; \
+            if (result < 0) { \
+                new = &((*new)->rb_left); \
+            } else if (result > 0) { \
+                new = &((*new)->rb_right); \
+            } else { \
+                insert = false; \
+                break; \
+            } \
+        } \
+        if (insert) { \
+            rb_link_node(item, parent, new); \
+            rb_insert_color_cached(item, root); \
+        } \
+    })
+
 /**
  * Delete node with given value from red black tree.
  *
@@ -200,6 +261,36 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
         } \
     })
 
+/**
+ * Split red black tree at value.
+ *
+ * Moves all nodes with key not before value to another tree, see
+ * rb_split_at().
+ *
+ * @param root tree root, keeps the nodes before value
+ * @param type type of the struct this is embedded in
+ * @param member name of the list structure within the struct
+ * @param key name of the key item within the struct
+ * @param value value to split the tree at
+ * @param cmp comparison function
+ * @param right tree root to move the remaining nodes to
+ */
+#define rb_split(root, type, member, key, value, cmp, right) ({ \
+        struct rb_node *node = (root)->rb_node, *first = NULL; \
+        while (node) { \
+            int result = cmp(rb_entry(node, type, member)->key, value); \
+            if (result > 0) { \
+                node = node->rb_right; \
+            } else { \
+                first = node; \
+                if (!result) \
+                    break; \
+                node = node->rb_left; \
+            } \
+        } \
+        rb_split_at(root, first, right); \
+    })
+
 /**
  * Iterate over a red black tree.
  *
@@ -0,0 +1,142 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RBTREE_SIZE_H_
+#define RBTREE_SIZE_H_
+
+#include "kernel.h"
+#include "rbtree.h"
+
+#include <stddef.h>
+
+/*
+ * Order statistics tree.
+ *
+ * Red black tree where each node also keeps the number of nodes of its
+ * subtree, maintained by the rb_augment_* functions. Finding the k-th node,
+ * the position of a node or the number of nodes within a key range then
+ * takes O(log n) instead of walking the tree. The tree must only be modified
+ * through the rb_size_* functions.
+ */
+
+/** Red black tree node with subtree size */
+struct rb_size_node {
+    struct rb_node rb;
+    /** Number of nodes of the subtree rooted at this node */
+    size_t rb_size;
+};
+
+/* Externals are commented with implementation */
+extern void rb_size_insert_color(struct rb_size_node *node, struct rb_root *root);
+extern void rb_size_erase(struct rb_size_node *node, struct rb_root *root);
+
+extern struct rb_size_node *rb_select(struct rb_root *root, size_t k);
+extern size_t rb_rank(struct rb_size_node *node);
+
+/**
+ * Get the subtree size of a possibly empty subtree.
+ *
+ * @param rb subtree root or NULL
+ */
+static inline size_t rb_size_of(struct rb_node *rb) {
+    return rb ? rb_entry(rb, struct rb_size_node, rb)->rb_size : 0;
+}
+
+/**
+ * Get the number of nodes in the tree, in constant time.
+ *
+ * @param root tree root
+ */
+#define rb_size_count(root) rb_size_of((root)->rb_node)
+
+/**
+ * Add node to order statistics tree.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the struct rb_size_node within the struct
+ * @param key name of the key item within the struct
+ * @param item struct rb_size_node to insert into the tree
+ * @param cmp comparison function
+ */
+#define rb_size_insert(root, type, member, key, item, cmp) ({ \
+        bool insert = true; \
+        struct rb_node **new = &((root)->rb_node), *parent = NULL; \
+        while (*new) { \
+            int result = cmp(rb_entry(*new, type, member.rb)->key, \
+                rb_entry(item, type, member)->key); \
+            parent = *new; \
+            if (result < 0) { \
+                new = &((*new)->rb_left); \
+            } else if (result > 0) { \
+                new = &((*new)->rb_right); \
+            } else { \
+                insert = false; \
+                break; \
+            } \
+        } \
+        if (insert) { \
+            rb_link_node(&(item)->rb, parent, new); \
+            rb_size_insert_color(item, root); \
+        } \
+    })
+
+/**
+ * Count nodes with key before value.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the struct rb_size_node within the struct
+ * @param key name of the key item within the struct
+ * @param value value to compare the keys with
+ * @param cmp comparison function
+ * @param incl whether to also count nodes with key equal to value
+ */
+#define __rb_count_before(root, type, member, key, value, cmp, incl) ({ \
+        size_t count = 0; \
+        struct rb_node *node = (root)->rb_node; \
+        while (node) { \
+            int result = cmp(rb_entry(node, type, member.rb)->key, value); \
+            if (result > 0 || (incl && result == 0)) { \
+                count += rb_size_of(node->rb_left) + 1; \
+                node = node->rb_right; \
+            } else { \
+                node = node->rb_left; \
+            } \
+        } \
+        count; \
+    })
+
+/**
+ * Count nodes with key in the range [lo, hi].
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the struct rb_size_node within the struct
+ * @param key name of the key item within the struct
+ * @param lo lowest value in the range
+ * @param hi highest value in the range, inclusive
+ * @param cmp comparison function
+ * @return number of nodes in the range
+ */
+#define rb_count_range(root, type, member, key, lo, hi, cmp) ({ \
+        size_t below = __rb_count_before(root, type, member, key, lo, cmp, false); \
+        size_t upto = __rb_count_before(root, type, member, key, hi, cmp, true); \
+        upto > below ? upto - below : 0; \
+    })
+
+#endif // RBTREE_SIZE_H_
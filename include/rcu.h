@@ -0,0 +1,133 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RCU_H_
+#define RCU_H_
+
+#include "atomic.h"
+#include "compiler.h"
+
+/*
+ * Read-copy-update with quiescent-state-based reclamation.
+ *
+ * Readers access shared data without locks, atomic read-modify-write
+ * operations or memory barriers; read-side critical sections cost nothing.
+ * Instead, each reader thread registers itself and periodically announces a
+ * quiescent state, a point at which it holds no references to RCU-protected
+ * data. A writer unlinks data so that new readers cannot find it, then
+ * synchronize_rcu() waits until every registered thread has passed through
+ * a quiescent state, after which no reader can still reference the data and
+ * it can be freed.
+ *
+ * Threads which block for a long time, or do not read RCU-protected data for
+ * a while, should go offline so that they do not delay writers.
+ */
+
+/**
+ * Assign pointer to RCU-protected data.
+ *
+ * Orders initialization of the pointed-to data before the pointer is
+ * published, so that readers never see uninitialized data.
+ *
+ * @param p pointer to assign to
+ * @param v value to assign
+ */
+#define rcu_assign_pointer(p, v) do { \
+    atomic_thread_fence(memory_order_release); \
+    ACCESS_ONCE(p) = (v); \
+  } while (0)
+
+/**
+ * Read pointer to RCU-protected data.
+ *
+ * Relies on the processor ordering dependent loads, which holds for every
+ * supported architecture.
+ *
+ * @param p pointer to read
+ */
+#define rcu_dereference(p) ACCESS_ONCE(p)
+
+/**
+ * Enter read-side critical section.
+ *
+ * Only prevents the compiler from moving accesses out of the section.
+ */
+static inline void rcu_read_lock(void) {
+  barrier();
+}
+
+/**
+ * Leave read-side critical section.
+ */
+static inline void rcu_read_unlock(void) {
+  barrier();
+}
+
+/**
+ * Register calling thread as RCU reader.
+ *
+ * The thread is online after registration.
+ */
+extern void rcu_register_thread(void);
+
+/**
+ * Unregister calling thread, which must not be in read-side critical section.
+ */
+extern void rcu_unregister_thread(void);
+
+/**
+ * Announce that calling thread holds no references to RCU-protected data.
+ */
+extern void rcu_quiescent_state(void);
+
+/**
+ * Put calling thread in extended quiescent state, it may not read
+ * RCU-protected data until rcu_thread_online() is called.
+ */
+extern void rcu_thread_offline(void);
+
+/**
+ * End extended quiescent state of calling thread.
+ */
+extern void rcu_thread_online(void);
+
+/**
+ * Wait until all registered threads pass through a quiescent state.
+ *
+ * Must not be called from read-side critical section. Data unlinked before
+ * the call is not referenced by any reader once it returns.
+ */
+extern void synchronize_rcu(void);
+
+/**
+ * Get the grace period which must elapse before data unlinked so far may be
+ * freed, without waiting for it.
+ *
+ * @return cookie to pass to poll_state_synchronize_rcu()
+ */
+extern unsigned long get_state_synchronize_rcu(void);
+
+/**
+ * Check whether a grace period has elapsed, run by any thread calling
+ * synchronize_rcu().
+ *
+ * @param state cookie returned by get_state_synchronize_rcu()
+ * @return true if data unlinked before getting the cookie may be freed
+ */
+extern bool poll_state_synchronize_rcu(unsigned long state);
+
+#endif // RCU_H_
@@ -0,0 +1,323 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROBIN_HTABLE_H_
+#define ROBIN_HTABLE_H_
+
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Robin Hood hash table.
+ *
+ * Open addressing with linear probing where an entry being inserted takes
+ * the slot of any entry closer to its home slot than itself, which keeps
+ * the distances of all entries from their home slots short and uniform even
+ * at high load. Slots are ordered by home slot, so a lookup can stop as
+ * soon as it reaches an entry closer to its home than the key would be.
+ *
+ * Deletion shifts the following entries back by one slot until reaching an
+ * empty slot or an entry in its home slot, so there are no tombstones and
+ * the table does not degrade under deletions.
+ */
+
+/** Default number of slots */
+#define ROBIN_HTABLE_NUM_SLOTS 16
+#ifndef ROBIN_HTABLE_MAX_LOAD
+/** Grow when the table is more than given number of sixteenths full */
+#define ROBIN_HTABLE_MAX_LOAD 15
+#endif
+
+/** Robin Hood hash table entry identified by key */
+struct robin_htable_entry {
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Result of hash function applied to key */
+  unsigned hash;
+};
+
+/** Slot of the table */
+struct robin_slot {
+  /** Entry stored in the slot */
+  struct robin_htable_entry *entry;
+  /** Hash of the entry, copied to avoid dereferencing the entry */
+  uint32_t hash;
+  /** Distance from the home slot plus one, zero for empty slots */
+  uint32_t dist;
+};
+
+/** Robin Hood hash table */
+struct robin_htable {
+  /** Slots of the table */
+  struct robin_slot *slots;
+  /** Number of slots, power of two */
+  size_t size;
+  /** Number of entries in the table */
+  size_t count;
+};
+
+/**
+ * Initialize new Robin Hood hash table entry.
+ */
+static inline void INIT_ROBIN_HTABLE_ENTRY(struct robin_htable_entry *entry, void *key, size_t len) {
+  entry->key = key;
+  entry->len = len;
+}
+
+/**
+ * Initialize new Robin Hood table of given size.
+ *
+ * @param table Robin Hood hash table
+ * @param n aproximate number of slots, rounded up to power of two
+ */
+static inline int robin_htable_init_n(struct robin_htable *table, size_t n) {
+  if (!table) {
+    return -1;
+  }
+
+  table->size = n > 0 ? roundup_pow_of_two(n) : ROBIN_HTABLE_NUM_SLOTS;
+  table->count = 0;
+  table->slots = (struct robin_slot *)calloc(table->size, sizeof(struct robin_slot));
+  assert(table->slots);
+
+  return 0;
+}
+
+/**
+ * Initialize new Robin Hood hash table.
+ *
+ * @param table Robin Hood hash table
+ */
+static inline int robin_htable_init(struct robin_htable *table) {
+  return robin_htable_init_n(table, ROBIN_HTABLE_NUM_SLOTS);
+}
+
+/**
+ * Destroy Robin Hood hash table.
+ *
+ * @param table Robin Hood hash table
+ */
+static inline void robin_htable_destroy(struct robin_htable *table) {
+  if (table) {
+    free(table->slots);
+  }
+}
+
+/**
+ * Insert entry, displacing entries closer to their home slots.
+ */
+static inline void __robin_htable_insert(struct robin_htable *table, struct robin_htable_entry *entry, uint32_t hash) {
+  size_t mask = table->size - 1;
+  struct robin_slot cur = { entry, hash, 1 };
+
+  for (size_t i = hash & mask;; i = (i + 1) & mask, cur.dist++) {
+    struct robin_slot *s = &table->slots[i];
+
+    if (!s->dist) {
+      *s = cur;
+      return;
+    }
+    if (s->dist < cur.dist) {
+      struct robin_slot tmp = *s;
+      *s = cur;
+      cur = tmp;
+    }
+  }
+}
+
+/**
+ * Rehash all entries into a table of given size.
+ *
+ * @param table Robin Hood hash table
+ * @param size new number of slots, must be power of two not smaller than the number of entries
+ */
+static inline int robin_htable_resize(struct robin_htable *table, size_t size) {
+  struct robin_slot *slots = table->slots;
+  size_t old_size = table->size;
+
+  if (!(table->slots = (struct robin_slot *)calloc(size, sizeof(struct robin_slot)))) {
+    table->slots = slots;
+    return -1;
+  }
+  table->size = size;
+
+  for (size_t i = 0; i < old_size; ++i) {
+    if (slots[i].dist) {
+      __robin_htable_insert(table, slots[i].entry, slots[i].hash);
+    }
+  }
+  free(slots);
+
+  return 0;
+}
+
+/**
+ * Add a new entry into Robin Hood hash table.
+ *
+ * @param table the Robin Hood hash table to insert entry into
+ * @param entry the Robin Hood hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ * @return 0 on success, -1 if the table is full and cannot grow
+ */
+static inline int robin_htable_add(struct robin_htable *table, struct robin_htable_entry *entry, void *key, size_t len) {
+  INIT_ROBIN_HTABLE_ENTRY(entry, key, len);
+  entry->hash = jhash(key, len, 0);
+
+  if ((table->count + 1) * 16 > table->size * ROBIN_HTABLE_MAX_LOAD) {
+    if (robin_htable_resize(table, table->size * 2)) {
+      return -1;
+    }
+  }
+
+  __robin_htable_insert(table, entry, entry->hash);
+  table->count++;
+
+  return 0;
+}
+
+/**
+ * Looks up the Robin Hood hash table for slot holding the key.
+ *
+ * @return slot index or -1 if there is no such entry
+ */
+static inline ssize_t __robin_htable_find_slot(const struct robin_htable *table, const void *key, size_t len, uint32_t hash) {
+  size_t mask = table->size - 1;
+  uint32_t dist = 1;
+
+  for (size_t i = hash & mask;; i = (i + 1) & mask, dist++) {
+    const struct robin_slot *s = &table->slots[i];
+
+    // Entries past this point are closer to their home slots than key would be
+    if (s->dist < dist) {
+      return -1;
+    }
+    if (s->hash == hash && s->entry->len == len && memcmp(s->entry->key, key, len) == 0) {
+      return i;
+    }
+  }
+}
+
+/**
+ * Looks up the Robin Hood hash table for the presence of key.
+ *
+ * @param table the Robin Hood hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct robin_htable_entry *robin_htable_find(const struct robin_htable *table, const void *key, size_t len) {
+  ssize_t slot = __robin_htable_find_slot(table, key, len, jhash(key, len, 0));
+  return slot >= 0 ? table->slots[slot].entry : NULL;
+}
+
+/**
+ * Remove entry in given slot, shifting the following entries back.
+ */
+static inline struct robin_htable_entry *__robin_htable_del_slot(struct robin_htable *table, size_t slot) {
+  struct robin_htable_entry *entry = table->slots[slot].entry;
+  size_t mask = table->size - 1;
+  size_t next;
+
+  for (next = (slot + 1) & mask; table->slots[next].dist > 1; slot = next, next = (next + 1) & mask) {
+    table->slots[slot] = table->slots[next];
+    table->slots[slot].dist--;
+  }
+  table->slots[slot].dist = 0;
+  table->count--;
+
+  return entry;
+}
+
+/**
+ * Remove entry with given key from Robin Hood hash table.
+ *
+ * @param table the Robin Hood hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if there is no such entry
+ */
+static inline struct robin_htable_entry *robin_htable_del_key(struct robin_htable *table, const void *key, size_t len) {
+  ssize_t slot = __robin_htable_find_slot(table, key, len, jhash(key, len, 0));
+  return slot >= 0 ? __robin_htable_del_slot(table, slot) : NULL;
+}
+
+/**
+ * Remove given entry from Robin Hood hash table.
+ *
+ * @param table the Robin Hood hash table
+ * @param entry the entry to remove
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct robin_htable_entry *robin_htable_del_entry(struct robin_htable *table, struct robin_htable_entry *entry) {
+  size_t mask = table->size - 1;
+  uint32_t dist = 1;
+
+  for (size_t i = entry->hash & mask; table->slots[i].dist >= dist; i = (i + 1) & mask, dist++) {
+    if (table->slots[i].entry == entry) {
+      return __robin_htable_del_slot(table, i);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the Robin Hood hash table entry pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define robin_hash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the Robin Hood hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define robin_hash_find_entry(table, key, len, type, member) ({ \
+    struct robin_htable_entry *e = robin_htable_find((table), (key), (len)); \
+    (type *)(e ? robin_hash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over Robin Hood hash table elements of given type.
+ *
+ * Entries must not be removed while iterating, as that moves other entries
+ * to slots which were already visited.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define robin_htable_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    for (pos = (table)->slots[i].dist ? (table)->slots[i].entry : NULL; \
+         pos && ({ tpos = robin_hash_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = NULL)
+
+#endif // ROBIN_HTABLE_H_
@@ -0,0 +1,268 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARDED_HTABLE_H_
+#define SHARDED_HTABLE_H_
+
+#include "hlist.h"
+#include "htable.h"
+#include "kernel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Hash table sharded by thread.
+ *
+ * Each thread adds entries to its own shard, a plain struct htable, and
+ * looks up entries there, e.g. to aggregate values by key, without any
+ * synchronization. The same key may then be present in several shards.
+ *
+ * Once all threads are done, the shards are merged into partitions, each
+ * another struct htable holding the keys whose hash falls into it. Merging
+ * happens in two steps, each parallel without locks: first every shard is
+ * split into per-partition lists by sharded_htable_split(), touching only
+ * that shard, then every partition collects its lists from all shards by
+ * sharded_htable_merge_part(), touching only that partition. Entries with
+ * a key already present in the partition are folded into the present entry
+ * by a callback. sharded_htable_merge() runs both steps on a pool of
+ * threads.
+ *
+ * All shards and partitions share the hash function and seed, so the hash
+ * cached in each entry stays valid and keys are never hashed again.
+ */
+
+/**
+ * Function folding an entry into the entry already present with its key.
+ *
+ * @param dst the entry present in the partition
+ * @param src the entry with the same key, which is left out of the table
+ * @param arg the argument passed to the merge
+ */
+typedef void (*sharded_htable_merge_f)(struct htable_entry *dst, struct htable_entry *src, void *arg);
+
+/** Hash table sharded by thread */
+struct sharded_htable {
+  /** Tables filled by each thread */
+  struct htable *shards;
+  /** Number of shards */
+  size_t nshards;
+  /** Tables holding the merged entries, by hash */
+  struct htable *parts;
+  /** Number of partitions */
+  size_t nparts;
+  /** Entries of each shard split by partition, nshards * nparts lists */
+  struct hlist_head *lists;
+};
+
+/**
+ * Get the shard owned by a thread.
+ *
+ * @param table sharded hash table
+ * @param i index of the shard
+ */
+#define sharded_htable_shard(table, i) (&(table)->shards[i])
+
+/**
+ * Get the partition of a hash.
+ *
+ * Uses the high bits of the hash, which do not select buckets of the
+ * partition until it grows very large.
+ */
+static inline size_t sharded_htable_which_part(const struct sharded_htable *table, unsigned hash) {
+  return (size_t)(((uint64_t)(uint32_t)hash * table->nparts) >> 32);
+}
+
+/**
+ * Initialize new sharded hash table.
+ *
+ * @param table sharded hash table
+ * @param nshards number of shards, usually the number of threads
+ * @param nparts number of partitions the shards are merged into
+ * @param n aproximate size of each shard
+ * @param flags table flags, see htable_init_hash()
+ */
+static inline int sharded_htable_init(struct sharded_htable *table, size_t nshards, size_t nparts, size_t n, unsigned flags) {
+  if (!table || !nshards || !nparts) {
+    return -1;
+  }
+
+  table->nshards = nshards;
+  table->nparts = nparts;
+  table->shards = (struct htable *)malloc(sizeof(struct htable) * nshards);
+  table->parts = (struct htable *)malloc(sizeof(struct htable) * nparts);
+  table->lists = (struct hlist_head *)malloc(sizeof(struct hlist_head) * nshards * nparts);
+  assert(table->shards && table->parts && table->lists);
+
+  // The first shard picks the seed, which all the other tables reuse
+  htable_init_flags(&table->shards[0], n, flags);
+  flags &= ~HTABLE_RANDOM_SEED;
+  for (size_t i = 1; i < nshards; ++i) {
+    htable_init_hash(&table->shards[i], n, flags, NULL, table->shards[0].seed);
+  }
+  for (size_t i = 0; i < nparts; ++i) {
+    htable_init_hash(&table->parts[i], 0, flags, NULL, table->shards[0].seed);
+  }
+  for (size_t i = 0; i < nshards * nparts; ++i) {
+    INIT_HLIST_HEAD(&table->lists[i]);
+  }
+
+  return 0;
+}
+
+/**
+ * Destroy sharded hash table.
+ *
+ * @param table sharded hash table
+ */
+static inline void sharded_htable_destroy(struct sharded_htable *table) {
+  if (!table) {
+    return;
+  }
+  for (size_t i = 0; i < table->nshards; ++i) {
+    htable_destroy(&table->shards[i]);
+  }
+  for (size_t i = 0; i < table->nparts; ++i) {
+    htable_destroy(&table->parts[i]);
+  }
+  free(table->shards);
+  free(table->parts);
+  free(table->lists);
+}
+
+/**
+ * Move all entries of a shard to per-partition lists.
+ *
+ * May run concurrently for different shards.
+ *
+ * @param table sharded hash table
+ * @param shard index of the shard
+ */
+static inline void sharded_htable_split(struct sharded_htable *table, size_t shard) {
+  struct htable *h = &table->shards[shard];
+  struct hlist_head *lists = &table->lists[shard * table->nparts];
+  struct htable_entry *pos, *n;
+
+  htable_for_each_safe(pos, n, h) {
+    htable_del_entry(h, pos);
+    hlist_add_head(&pos->node, &lists[sharded_htable_which_part(table, pos->hash)]);
+  }
+}
+
+/**
+ * Move entries of all shards belonging to a partition into it.
+ *
+ * May run concurrently for different partitions, once all shards have been
+ * split.
+ *
+ * @param table sharded hash table
+ * @param part index of the partition
+ * @param fn the function folding entries with a key already present, NULL
+ *           to keep all entries
+ * @param arg the argument to pass to the function
+ */
+static inline void sharded_htable_merge_part(struct sharded_htable *table, size_t part, sharded_htable_merge_f fn, void *arg) {
+  struct htable *h = &table->parts[part];
+  struct hlist_node *pos, *tmp;
+  size_t n = 0;
+
+  for (size_t i = 0; i < table->nshards; ++i) {
+    hlist_for_each(pos, &table->lists[i * table->nparts + part]) {
+      n++;
+    }
+  }
+  // Lists of other shards are expected to hold mostly the same keys
+  htable_reserve(h, h->count + n / table->nshards);
+
+  for (size_t i = 0; i < table->nshards; ++i) {
+    hlist_for_each_safe(pos, tmp, &table->lists[i * table->nparts + part]) {
+      struct htable_entry *e = hlist_entry(pos, struct htable_entry, node), *dst;
+
+      hlist_del_init(pos);
+      if (fn && (dst = __htable_find_hashed(h, e->key, e->len, e->hash, __htable_key_eq))) {
+        fn(dst, e, arg);
+      } else {
+        __htable_add_hashed(h, e);
+      }
+    }
+  }
+}
+
+/**
+ * Merge all shards into partitions using a pool of threads.
+ *
+ * Shards are empty afterwards and may be filled again.
+ *
+ * @param table sharded hash table
+ * @param nthreads number of threads to use
+ * @param fn the function folding entries with a key already present, NULL
+ *           to keep all entries
+ * @param arg the argument to pass to the function
+ * @return 0 on success, -1 on error with errno set
+ */
+extern int sharded_htable_merge(struct sharded_htable *table, size_t nthreads, sharded_htable_merge_f fn, void *arg);
+
+/**
+ * Looks up the merged partitions for the presence of key.
+ *
+ * @param table the sharded hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct htable_entry *sharded_htable_find(const struct sharded_htable *table, const void *key, size_t len) {
+  unsigned hash = __htable_hash(&table->parts[0], key, len);
+  return __htable_find_hashed(&table->parts[sharded_htable_which_part(table, hash)], key, len, hash, __htable_key_eq);
+}
+
+/**
+ * Get the number of merged entries.
+ *
+ * @param table sharded hash table
+ */
+static inline size_t sharded_htable_count(const struct sharded_htable *table) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < table->nparts; ++i) {
+    count += table->parts[i].count;
+  }
+  return count;
+}
+
+/**
+ * Looks up the merged partitions for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define sharded_hash_find_entry(table, key, len, type, member) ({ \
+    struct htable_entry *e = sharded_htable_find((table), (key), (len)); \
+    (type *)(e ? hash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over merged elements of given type.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define sharded_htable_for_each_entry(tpos, pos, table, member) \
+  for (size_t __p = 0; __p < (table)->nparts; ++__p) \
+    htable_for_each_entry(tpos, pos, &(table)->parts[__p], member)
+
+#endif // SHARDED_HTABLE_H_
@@ -0,0 +1,192 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPINLOCK_H_
+#define SPINLOCK_H_
+
+#include "atomic.h"
+#include "compiler.h"
+
+#include <stdbool.h>
+
+/** Size of cache line used to keep locks apart */
+#define SMP_CACHE_BYTES 64
+
+#define ____cacheline_aligned __aligned(SMP_CACHE_BYTES)
+
+/** Hint to the processor that we are busy waiting */
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause" : : : "memory")
+#else
+#define cpu_relax() barrier()
+#endif
+
+/** Spin lock */
+struct spinlock {
+  atomic_flag locked;
+};
+
+#define SPINLOCK_INIT { .locked = ATOMIC_FLAG_INIT }
+
+static inline void spin_lock_init(struct spinlock *lock) {
+  atomic_init(&lock->locked, 0);
+}
+
+/**
+ * Try to acquire spin lock without waiting.
+ *
+ * @return true if the lock was acquired
+ */
+static inline bool spin_trylock(struct spinlock *lock) {
+  return !atomic_flag_test_and_set_explicit(&lock->locked, memory_order_acquire);
+}
+
+/**
+ * Acquire spin lock.
+ *
+ * Waits on a plain load so that the cache line is not bounced between
+ * waiting processors.
+ */
+static inline void spin_lock(struct spinlock *lock) {
+  while (!spin_trylock(lock)) {
+    while (atomic_load_explicit(&lock->locked, memory_order_relaxed)) {
+      cpu_relax();
+    }
+  }
+}
+
+static inline void spin_unlock(struct spinlock *lock) {
+  atomic_flag_clear_explicit(&lock->locked, memory_order_release);
+}
+
+/*
+ * Sequence counter.
+ *
+ * Writers make the sequence odd while they modify the protected data.
+ * Readers take no lock and do not write shared memory: they read the sequence
+ * before and after reading the data and retry if a writer was active in
+ * between. Data read inside the section must not be trusted until
+ * read_seqcount_retry() succeeds, and pointers followed inside it must stay
+ * valid memory even when they are concurrently modified.
+ *
+ * The counter does not serialize writers, see sequence lock below.
+ */
+
+/** Sequence counter */
+struct seqcount {
+  atomic_uint sequence;
+};
+
+#define SEQCOUNT_INIT { .sequence = ATOMIC_VAR_INIT(0) }
+
+static inline void seqcount_init(struct seqcount *s) {
+  atomic_init(&s->sequence, 0);
+}
+
+/**
+ * Begin read section.
+ *
+ * @return sequence to pass to read_seqcount_retry()
+ */
+static inline unsigned read_seqcount_begin(const struct seqcount *s) {
+  unsigned seq;
+
+  while ((seq = atomic_load_explicit((atomic_uint *)&s->sequence, memory_order_acquire)) & 1) {
+    cpu_relax();
+  }
+  return seq;
+}
+
+/**
+ * End read section.
+ *
+ * @param seq sequence returned by read_seqcount_begin()
+ * @return true if the section has to be retried
+ */
+static inline bool read_seqcount_retry(const struct seqcount *s, unsigned seq) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit((atomic_uint *)&s->sequence, memory_order_relaxed) != seq;
+}
+
+static inline void write_seqcount_begin(struct seqcount *s) {
+  atomic_store_explicit(&s->sequence, atomic_load_explicit(&s->sequence, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void write_seqcount_end(struct seqcount *s) {
+  atomic_store_explicit(&s->sequence, atomic_load_explicit(&s->sequence, memory_order_relaxed) + 1,
+      memory_order_release);
+}
+
+/*
+ * Sequence lock.
+ *
+ * Sequence counter whose writers are serialized by spinning on the counter
+ * itself until it is even.
+ */
+
+/** Sequence lock */
+struct seqlock {
+  struct seqcount seqcount;
+};
+
+#define SEQLOCK_INIT { .seqcount = SEQCOUNT_INIT }
+
+static inline void seqlock_init(struct seqlock *sl) {
+  seqcount_init(&sl->seqcount);
+}
+
+/**
+ * Begin read section.
+ *
+ * @return sequence to pass to read_seqretry()
+ */
+static inline unsigned read_seqbegin(const struct seqlock *sl) {
+  return read_seqcount_begin(&sl->seqcount);
+}
+
+/**
+ * End read section.
+ *
+ * @param seq sequence returned by read_seqbegin()
+ * @return true if the section has to be retried
+ */
+static inline bool read_seqretry(const struct seqlock *sl, unsigned seq) {
+  return read_seqcount_retry(&sl->seqcount, seq);
+}
+
+static inline void write_seqlock(struct seqlock *sl) {
+  atomic_uint *sequence = &sl->seqcount.sequence;
+  unsigned seq;
+
+  for (;;) {
+    seq = atomic_load_explicit(sequence, memory_order_relaxed);
+    if (!(seq & 1) && atomic_compare_exchange_weak_explicit(sequence, &seq, seq + 1,
+          memory_order_acquire, memory_order_relaxed)) {
+      break;
+    }
+    cpu_relax();
+  }
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void write_sequnlock(struct seqlock *sl) {
+  write_seqcount_end(&sl->seqcount);
+}
+
+#endif // SPINLOCK_H_
@@ -0,0 +1,228 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "htable_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Entry to be written */
+struct htable_file_record {
+    const struct htable_entry *entry;
+    const void *value;
+    size_t vallen;
+    uint32_t hash;
+};
+
+/**
+ * Collect entries of the table and compute the bucket offsets.
+ *
+ * @param recs array to store the entries to
+ * @param bucks array of size + 1 offsets, zeroed
+ * @return 0 on success, -1 if a key or value is too long
+ */
+static int htable_file_collect(const struct htable *table, struct htable_file_record *recs,
+        uint64_t *bucks, size_t size, htable_file_value_f fn, void *arg) {
+    struct htable_entry *pos;
+    size_t n = 0;
+
+    htable_for_each(pos, table) {
+        struct htable_file_record *rec = &recs[n++];
+
+        rec->entry = pos;
+        rec->value = fn ? fn(pos, &rec->vallen, arg) : NULL;
+        if (!rec->value) {
+            rec->vallen = 0;
+        }
+        if (pos->len > UINT32_MAX || rec->vallen > UINT32_MAX) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        rec->hash = jhash(pos->key, pos->len, table->seed);
+        bucks[(rec->hash & (size - 1)) + 1] += __htable_file_entry_size(pos->len, rec->vallen);
+    }
+
+    bucks[0] = sizeof(struct htable_file_header) + sizeof(uint64_t) * (size + 1);
+    for (size_t i = 1; i <= size; ++i) {
+        bucks[i] += bucks[i - 1];
+    }
+    return 0;
+}
+
+/**
+ * Fill mapped file with the header, bucket offsets and entries.
+ */
+static void htable_file_fill(uint8_t *base, const struct htable *table, const struct htable_file_record *recs,
+        const uint64_t *bucks, size_t size, uint64_t len) {
+    struct htable_file_header *hdr = (struct htable_file_header *)base;
+    uint64_t *offs = (uint64_t *)(base + sizeof(*hdr));
+
+    hdr->magic = HTABLE_FILE_MAGIC;
+    hdr->version = HTABLE_FILE_VERSION;
+    hdr->seed = table->seed;
+    hdr->size = size;
+    hdr->count = table->count;
+    hdr->bucks = sizeof(*hdr);
+    hdr->len = len;
+
+    // Offsets are advanced as entries are placed, then restored
+    memcpy(offs, bucks, sizeof(uint64_t) * (size + 1));
+    for (size_t i = 0; i < table->count; ++i) {
+        const struct htable_file_record *rec = &recs[i];
+        uint64_t *off = &offs[rec->hash & (size - 1)];
+        struct htable_file_entry *e = (struct htable_file_entry *)(base + *off);
+
+        e->hash = rec->hash;
+        e->keylen = rec->entry->len;
+        e->vallen = rec->vallen;
+        memcpy(e->data, rec->entry->key, e->keylen);
+        if (e->vallen) {
+            memcpy((uint8_t *)htable_file_value(e), rec->value, e->vallen);
+        }
+        *off += __htable_file_entry_size(e->keylen, e->vallen);
+    }
+    memcpy(offs, bucks, sizeof(uint64_t) * (size + 1));
+}
+
+int htable_file_build(const struct htable *table, const char *path, htable_file_value_f fn, void *arg) {
+    size_t size = table->count > 0 ? roundup_pow_of_two(table->count) : 1;
+    struct htable_file_record *recs;
+    uint64_t *bucks;
+    uint8_t *base;
+    char *tmp = NULL;
+    int fd = -1, err;
+    uint64_t len;
+
+    recs = malloc(sizeof(*recs) * max_t(size_t, table->count, 1));
+    bucks = calloc(size + 1, sizeof(uint64_t));
+    if (!recs || !bucks) {
+        goto fail;
+    }
+
+    if (htable_file_collect(table, recs, bucks, size, fn, arg)) {
+        goto fail;
+    }
+    len = bucks[size];
+
+    if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+        goto fail;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    // The file is zero-filled by ftruncate(), which takes care of padding
+    if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 || ftruncate(fd, len)) {
+        goto fail_unlink;
+    }
+    if ((base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        goto fail_unlink;
+    }
+    htable_file_fill(base, table, recs, bucks, size, len);
+    if (munmap(base, len) || fsync(fd)) {
+        goto fail_unlink;
+    }
+    if (close(fd)) {
+        fd = -1;
+        goto fail_unlink;
+    }
+    fd = -1;
+
+    if (rename(tmp, path)) {
+        goto fail_unlink;
+    }
+
+    free(tmp);
+    free(bucks);
+    free(recs);
+    return 0;
+
+fail_unlink:
+    err = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(tmp);
+    errno = err;
+fail:
+    err = errno;
+    free(tmp);
+    free(bucks);
+    free(recs);
+    errno = err;
+    return -1;
+}
+
+int htable_file_open(struct htable_file *file, const char *path) {
+    const struct htable_file_header *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    hdr = base;
+    if (hdr->magic != HTABLE_FILE_MAGIC || hdr->version != HTABLE_FILE_VERSION ||
+            hdr->len != (uint64_t)st.st_size || !hdr->size || (hdr->size & (hdr->size - 1)) ||
+            !IS_ALIGNED(hdr->bucks, sizeof(uint64_t)) || hdr->bucks < sizeof(*hdr) || hdr->bucks > hdr->len ||
+            hdr->size >= (hdr->len - hdr->bucks) / sizeof(uint64_t)) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    file->base = base;
+    file->len = st.st_size;
+    file->bucks = (const uint64_t *)(file->base + hdr->bucks);
+    file->size = hdr->size;
+    file->seed = hdr->seed;
+
+    if (file->bucks[file->size] > file->len) {
+        htable_file_close(file);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void htable_file_close(struct htable_file *file) {
+    munmap((void *)file->base, file->len);
+    file->base = NULL;
+    file->bucks = NULL;
+}
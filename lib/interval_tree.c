@@ -0,0 +1,161 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "interval_tree.h"
+
+#define itree_entry(ptr) rb_entry(ptr, struct interval_tree_node, rb)
+
+/**
+ * Recompute the greatest last of the subtree rooted at node.
+ *
+ * @param rb node to update
+ * @param data unused
+ */
+static void interval_tree_augment(struct rb_node *rb, void *data) {
+    struct interval_tree_node *node = itree_entry(rb);
+    unsigned long max = node->last;
+
+    (void)data;
+    if (rb->rb_left && itree_entry(rb->rb_left)->__subtree_last > max)
+        max = itree_entry(rb->rb_left)->__subtree_last;
+    if (rb->rb_right && itree_entry(rb->rb_right)->__subtree_last > max)
+        max = itree_entry(rb->rb_right)->__subtree_last;
+    node->__subtree_last = max;
+}
+
+/**
+ * Insert interval into interval tree.
+ *
+ * @param node interval to insert, start and last set
+ * @param root tree root
+ */
+void interval_tree_insert(struct interval_tree_node *node, struct rb_root *root) {
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (node->start < itree_entry(parent)->start)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+
+    node->__subtree_last = node->last;
+    rb_link_node(&node->rb, parent, link);
+    rb_insert_color(&node->rb, root);
+    rb_augment_insert(&node->rb, interval_tree_augment, NULL);
+}
+
+/**
+ * Remove interval from interval tree.
+ *
+ * @param node interval to remove
+ * @param root tree root
+ */
+void interval_tree_remove(struct interval_tree_node *node, struct rb_root *root) {
+    struct rb_node *deepest = rb_augment_erase_begin(&node->rb);
+
+    rb_erase(&node->rb, root);
+    rb_augment_erase_end(deepest, interval_tree_augment, NULL);
+}
+
+/**
+ * Find the leftmost interval of a subtree overlapping [start, last].
+ *
+ * The subtree must contain an interval ending at start or after.
+ */
+static struct interval_tree_node *interval_tree_subtree_search(struct interval_tree_node *node,
+        unsigned long start, unsigned long last) {
+    for (;;) {
+        /* the leftmost overlapping interval is in the left subtree if any is */
+        if (node->rb.rb_left) {
+            struct interval_tree_node *left = itree_entry(node->rb.rb_left);
+            if (start <= left->__subtree_last) {
+                node = left;
+                continue;
+            }
+        }
+        /* intervals of the right subtree start no earlier than this one */
+        if (node->start <= last) {
+            if (start <= node->last)
+                return node;
+            if (node->rb.rb_right) {
+                node = itree_entry(node->rb.rb_right);
+                if (start <= node->__subtree_last)
+                    continue;
+            }
+        }
+        return NULL;
+    }
+}
+
+/**
+ * Returns the first interval overlapping [start, last] in order of start.
+ *
+ * @param root tree root
+ * @param start first point of the query interval
+ * @param last last point of the query interval, inclusive
+ * @return overlapping interval or NULL
+ */
+struct interval_tree_node *interval_tree_iter_first(struct rb_root *root,
+        unsigned long start, unsigned long last) {
+    struct interval_tree_node *node;
+
+    if (!root->rb_node)
+        return NULL;
+    node = itree_entry(root->rb_node);
+    if (node->__subtree_last < start)
+        return NULL;
+    return interval_tree_subtree_search(node, start, last);
+}
+
+/**
+ * Returns the next interval overlapping [start, last] in order of start.
+ *
+ * @param node interval returned by the previous call
+ * @param start first point of the query interval
+ * @param last last point of the query interval, inclusive
+ * @return overlapping interval or NULL
+ */
+struct interval_tree_node *interval_tree_iter_next(struct interval_tree_node *node,
+        unsigned long start, unsigned long last) {
+    struct rb_node *rb = node->rb.rb_right, *prev;
+
+    for (;;) {
+        /* intervals of the right subtree follow this one */
+        if (rb) {
+            struct interval_tree_node *right = itree_entry(rb);
+            if (start <= right->__subtree_last)
+                return interval_tree_subtree_search(right, start, last);
+        }
+
+        /* go up until coming from the left child, that parent is next */
+        do {
+            rb = rb_parent(&node->rb);
+            if (!rb)
+                return NULL;
+            prev = &node->rb;
+            node = itree_entry(rb);
+            rb = node->rb.rb_right;
+        } while (prev == rb);
+
+        if (last < node->start)
+            return NULL;
+        if (start <= node->last)
+            return node;
+    }
+}
@@ -76,8 +76,9 @@ static void __rb_rotate_right(struct rb_node *node, struct rb_root *root) {
  *
  * @param node inserted node
  * @param root tree root
+ * @return whether the root turned black, adding to the black height
  */
-void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+static bool __rb_insert_color(struct rb_node *node, struct rb_root *root) {
     struct rb_node *parent, *gparent;
 
     while ((parent = rb_parent(node)) && rb_is_red(parent)) {
@@ -132,7 +133,20 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root) {
         }
     }
 
+    if (rb_is_black(root->rb_node))
+        return false;
     rb_set_black(root->rb_node);
+    return true;
+}
+
+/**
+ * Insert node into red black tree and check colors.
+ *
+ * @param node inserted node
+ * @param root tree root
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    __rb_insert_color(node, root);
 }
 
 /**
@@ -477,3 +491,268 @@ void rb_replace_node(struct rb_node *victim, struct rb_node *new, struct rb_root
     /* copy the pointers/colour from the victim to the replacement */
     *new = *victim;
 }
+
+static struct rb_node *__rb_build_sorted(struct rb_node **nodes, size_t n,
+        struct rb_node *parent, unsigned depth, unsigned red) {
+    struct rb_node *node;
+    size_t mid = n / 2;
+
+    if (!n)
+        return NULL;
+
+    node = nodes[mid];
+    node->rb_parent_color = (unsigned long)parent | (depth == red ? RB_RED : RB_BLACK);
+    node->rb_left = __rb_build_sorted(nodes, mid, node, depth + 1, red);
+    node->rb_right = __rb_build_sorted(nodes + mid + 1, n - mid - 1, node, depth + 1, red);
+    return node;
+}
+
+/**
+ * Build red black tree from nodes already in sort order.
+ *
+ * Links the nodes into a balanced tree in linear time without comparing
+ * them, replacing any previous content of the tree. Subtree sizes never
+ * differ by more than one, so all levels but the deepest are complete;
+ * nodes of an incomplete deepest level are red, all the others black.
+ *
+ * @param root tree root
+ * @param nodes nodes in sort order
+ * @param n number of nodes
+ */
+void rb_build_sorted(struct rb_root *root, struct rb_node **nodes, size_t n) {
+    unsigned red = UINT_MAX, depth = 0;
+
+    /* unless the tree is perfect, color its deepest level red */
+    if (n & (n + 1)) {
+        while ((size_t)2 << depth <= n)
+            depth++;
+        red = depth;
+    }
+    root->rb_node = __rb_build_sorted(nodes, n, NULL, 0, red);
+}
+
+/**
+ * Insert node into red black tree with cached root and check colors.
+ *
+ * The node has just been linked, so it is the new first node exactly when
+ * it is the left child of the previous first node, and likewise for the
+ * last node.
+ *
+ * @param node inserted node
+ * @param root cached tree root
+ */
+void rb_insert_color_cached(struct rb_node *node, struct rb_root_cached *root) {
+    struct rb_node *parent = rb_parent(node);
+
+    if (!root->rb_leftmost || (parent == root->rb_leftmost && parent->rb_left == node))
+        root->rb_leftmost = node;
+    if (!root->rb_rightmost || (parent == root->rb_rightmost && parent->rb_right == node))
+        root->rb_rightmost = node;
+
+    rb_insert_color(node, &root->rb_root);
+}
+
+/**
+ * Erase node from red black tree with cached root.
+ *
+ * The first node has no left child, so its successor is found in constant
+ * time, and likewise for the last node.
+ *
+ * @param node erased node
+ * @param root cached tree root
+ */
+void rb_erase_cached(struct rb_node *node, struct rb_root_cached *root) {
+    if (root->rb_leftmost == node)
+        root->rb_leftmost = rb_next(node);
+    if (root->rb_rightmost == node)
+        root->rb_rightmost = rb_prev(node);
+
+    rb_erase(node, &root->rb_root);
+}
+
+/**
+ * Replace node in red black tree with cached root.
+ *
+ * @param victim node to be replaced
+ * @param new node that replaces @p victim node
+ * @param root cached tree root
+ */
+void rb_replace_node_cached(struct rb_node *victim, struct rb_node *new, struct rb_root_cached *root) {
+    if (root->rb_leftmost == victim)
+        root->rb_leftmost = new;
+    if (root->rb_rightmost == victim)
+        root->rb_rightmost = new;
+
+    rb_replace_node(victim, new, &root->rb_root);
+}
+
+/**
+ * Remove the first node of red black tree with cached root.
+ *
+ * @param root cached tree root
+ * @return the removed node, NULL if the tree is empty
+ */
+struct rb_node *rb_pop_first_cached(struct rb_root_cached *root) {
+    struct rb_node *node = root->rb_leftmost;
+
+    if (node)
+        rb_erase_cached(node, root);
+    return node;
+}
+
+/**
+ * Returns the number of black nodes on any path from node down to a leaf.
+ */
+static unsigned __rb_black_height(struct rb_node *node) {
+    unsigned height = 0;
+
+    for (; node; node = node->rb_left)
+        height += rb_is_black(node);
+    return height;
+}
+
+/**
+ * Make a subtree a tree of its own, with black root.
+ *
+ * @param node subtree root or NULL
+ * @param height black height of node within its former tree
+ * @return black height of the new tree
+ */
+static unsigned __rb_detach(struct rb_node *node, unsigned height) {
+    if (!node)
+        return 0;
+    rb_set_parent(node, NULL);
+    if (rb_is_black(node))
+        return height;
+    rb_set_black(node);
+    return height + 1;
+}
+
+/**
+ * Join two trees of known black heights with a node between them.
+ *
+ * The pivot replaces the node on the facing spine of the taller tree whose
+ * black height is that of the shorter tree, which becomes its other child,
+ * and is then rebalanced as if just inserted. This takes time proportional
+ * to the difference of the black heights.
+ *
+ * @param root root to store the joined tree in
+ * @param left root of the tree with nodes before pivot, black or NULL
+ * @param lh black height of left
+ * @param pivot node to join the trees with
+ * @param right root of the tree with nodes after pivot, black or NULL
+ * @param rh black height of right
+ * @return black height of the joined tree
+ */
+static unsigned __rb_join(struct rb_root *root, struct rb_node *left, unsigned lh,
+        struct rb_node *pivot, struct rb_node *right, unsigned rh) {
+    struct rb_node *node, *parent = NULL;
+    unsigned height;
+
+    if (lh == rh) {
+        pivot->rb_parent_color = RB_BLACK;
+        pivot->rb_left = left;
+        pivot->rb_right = right;
+        if (left)
+            rb_set_parent(left, pivot);
+        if (right)
+            rb_set_parent(right, pivot);
+        root->rb_node = pivot;
+        return lh + 1;
+    }
+
+    if (lh > rh) {
+        for (node = left, height = lh; height > rh || (node && rb_is_red(node)); node = node->rb_right) {
+            height -= rb_is_black(node);
+            parent = node;
+        }
+        parent->rb_right = pivot;
+        pivot->rb_left = node;
+        pivot->rb_right = right;
+        root->rb_node = left;
+    } else {
+        for (node = right, height = rh; height > lh || (node && rb_is_red(node)); node = node->rb_left) {
+            height -= rb_is_black(node);
+            parent = node;
+        }
+        parent->rb_left = pivot;
+        pivot->rb_left = left;
+        pivot->rb_right = node;
+        root->rb_node = right;
+    }
+
+    pivot->rb_parent_color = (unsigned long)parent;
+    if (pivot->rb_left)
+        rb_set_parent(pivot->rb_left, pivot);
+    if (pivot->rb_right)
+        rb_set_parent(pivot->rb_right, pivot);
+    return max(lh, rh) + __rb_insert_color(pivot, root);
+}
+
+/**
+ * Join two red black trees with a node between them.
+ *
+ * All nodes of left must sort before pivot and all nodes of right after
+ * it. Takes O(log n) time. Augmented data and cached roots are not updated.
+ *
+ * @param left tree with nodes before pivot, holds the joined tree afterwards
+ * @param pivot node to join the trees with, not in either tree
+ * @param right tree with nodes after pivot, empty afterwards
+ */
+void rb_join(struct rb_root *left, struct rb_node *pivot, struct rb_root *right) {
+    __rb_join(left, left->rb_node, __rb_black_height(left->rb_node),
+              pivot, right->rb_node, __rb_black_height(right->rb_node));
+    right->rb_node = NULL;
+}
+
+/**
+ * Split red black tree before a node.
+ *
+ * Walks up from the node, joining the subtrees hanging off the path to
+ * either side. The black heights of the joined trees grow along the path,
+ * so all joins together take O(log n) time.
+ *
+ * @param root tree to split, holds the nodes before node afterwards
+ * @param node first node to move, NULL to move none
+ * @param right tree to store node and all nodes after it in, replacing its
+ *              previous content
+ */
+void rb_split_at(struct rb_root *root, struct rb_node *node, struct rb_root *right) {
+    struct rb_node *parent, *left, *sibling, *child = node;
+    unsigned height, lh, rh, sh;
+    bool black;
+
+    right->rb_node = NULL;
+    if (!node)
+        return;
+
+    parent = rb_parent(node);
+    height = __rb_black_height(node);
+    left = node->rb_left;
+    lh = __rb_detach(left, height - rb_is_black(node));
+    sh = __rb_detach(node->rb_right, height - rb_is_black(node));
+    rh = __rb_join(right, NULL, 0, node, node->rb_right, sh);
+
+    while (parent) {
+        struct rb_node *next = rb_parent(parent);
+
+        black = rb_is_black(parent);
+        if (child == parent->rb_left) {
+            sibling = parent->rb_right;
+            sh = __rb_detach(sibling, height);
+            rh = __rb_join(right, right->rb_node, rh, parent, sibling, sh);
+        } else {
+            struct rb_root tmp;
+
+            sibling = parent->rb_left;
+            sh = __rb_detach(sibling, height);
+            lh = __rb_join(&tmp, sibling, sh, parent, left, lh);
+            left = tmp.rb_node;
+        }
+        height += black;
+        child = parent;
+        parent = next;
+    }
+
+    root->rb_node = left;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rbtree_size.h"
+
+/**
+ * Recompute the size of the subtree rooted at node.
+ *
+ * @param rb node to update
+ * @param data unused
+ */
+static void rb_size_augment(struct rb_node *rb, void *data) {
+    (void)data;
+    rb_entry(rb, struct rb_size_node, rb)->rb_size =
+        rb_size_of(rb->rb_left) + rb_size_of(rb->rb_right) + 1;
+}
+
+/**
+ * Rebalance order statistics tree after linking a new node.
+ *
+ * @param node node linked by rb_link_node()
+ * @param root tree root
+ */
+void rb_size_insert_color(struct rb_size_node *node, struct rb_root *root) {
+    node->rb_size = 1;
+    rb_insert_color(&node->rb, root);
+    rb_augment_insert(&node->rb, rb_size_augment, NULL);
+}
+
+/**
+ * Remove node from order statistics tree.
+ *
+ * @param node node to remove
+ * @param root tree root
+ */
+void rb_size_erase(struct rb_size_node *node, struct rb_root *root) {
+    struct rb_node *deepest = rb_augment_erase_begin(&node->rb);
+
+    rb_erase(&node->rb, root);
+    rb_augment_erase_end(deepest, rb_size_augment, NULL);
+}
+
+/**
+ * Returns the k-th node (in sort order) of the tree.
+ *
+ * @param root tree root
+ * @param k position of the node, starting at 0
+ * @return node or NULL if the tree has no more than k nodes
+ */
+struct rb_size_node *rb_select(struct rb_root *root, size_t k) {
+    struct rb_node *node = root->rb_node;
+
+    while (node) {
+        size_t left = rb_size_of(node->rb_left);
+
+        if (k < left) {
+            node = node->rb_left;
+        } else if (k > left) {
+            k -= left + 1;
+            node = node->rb_right;
+        } else {
+            return rb_entry(node, struct rb_size_node, rb);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns the position (in sort order) of the node in its tree.
+ *
+ * @param node node of the tree
+ * @return number of nodes before it
+ */
+size_t rb_rank(struct rb_size_node *node) {
+    struct rb_node *rb = &node->rb, *parent;
+    size_t rank = rb_size_of(rb->rb_left);
+
+    while ((parent = rb_parent(rb))) {
+        if (rb == parent->rb_right)
+            rank += rb_size_of(parent->rb_left) + 1;
+        rb = parent;
+    }
+    return rank;
+}
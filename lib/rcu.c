@@ -0,0 +1,162 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rcu.h"
+#include "list.h"
+#include "spinlock.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Each registered thread keeps a copy of the global grace period counter,
+ * refreshed at every quiescent state, or zero while the thread is offline.
+ * synchronize_rcu() advances the global counter and waits until every thread
+ * has either caught up with it or gone offline.
+ */
+
+/** Counter value of offline threads */
+#define RCU_GP_OFFLINE 0
+/** Number of busy waiting iterations before yielding the processor */
+#define RCU_SPIN_COUNT 1000
+
+/** Registered reader thread */
+struct rcu_reader {
+    /** Grace period counter observed at the last quiescent state */
+    atomic_ulong ctr;
+    /** Node in the list of registered threads */
+    struct list_head node;
+    /** Whether the thread is registered */
+    bool registered;
+} ____cacheline_aligned;
+
+/** Global grace period counter */
+static atomic_ulong rcu_gp_ctr = ATOMIC_VAR_INIT(1);
+/** Last grace period which has elapsed */
+static atomic_ulong rcu_gp_done = ATOMIC_VAR_INIT(1);
+/** Serializes grace periods and guards the registry */
+static pthread_mutex_t rcu_gp_lock = PTHREAD_MUTEX_INITIALIZER;
+/** List of registered threads */
+static LIST_HEAD(rcu_registry);
+
+static __thread struct rcu_reader rcu_reader;
+
+void rcu_register_thread(void) {
+    pthread_mutex_lock(&rcu_gp_lock);
+    atomic_store_explicit(&rcu_reader.ctr, atomic_load_explicit(&rcu_gp_ctr, memory_order_relaxed),
+            memory_order_relaxed);
+    list_add(&rcu_reader.node, &rcu_registry);
+    rcu_reader.registered = true;
+    pthread_mutex_unlock(&rcu_gp_lock);
+}
+
+void rcu_unregister_thread(void) {
+    // Going offline first lets a grace period in progress complete
+    rcu_thread_offline();
+
+    pthread_mutex_lock(&rcu_gp_lock);
+    list_del(&rcu_reader.node);
+    rcu_reader.registered = false;
+    pthread_mutex_unlock(&rcu_gp_lock);
+}
+
+void rcu_quiescent_state(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    atomic_store_explicit(&rcu_reader.ctr, atomic_load_explicit(&rcu_gp_ctr, memory_order_relaxed),
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void rcu_thread_offline(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    atomic_store_explicit(&rcu_reader.ctr, RCU_GP_OFFLINE, memory_order_relaxed);
+}
+
+void rcu_thread_online(void) {
+    atomic_store_explicit(&rcu_reader.ctr, atomic_load_explicit(&rcu_gp_ctr, memory_order_relaxed),
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * Get the grace period following given one, skipping the offline value.
+ */
+static unsigned long rcu_gp_next(unsigned long gp) {
+    return gp + 1 == RCU_GP_OFFLINE ? gp + 2 : gp + 1;
+}
+
+/**
+ * Wait until reader observes given grace period or goes offline.
+ */
+static void rcu_wait_for_reader(struct rcu_reader *reader, unsigned long gp) {
+    unsigned long ctr;
+
+    for (unsigned i = 0; (ctr = atomic_load_explicit(&reader->ctr, memory_order_relaxed)) != RCU_GP_OFFLINE &&
+            ctr != gp; ++i) {
+        if (i < RCU_SPIN_COUNT) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+void synchronize_rcu(void) {
+    struct list_head *pos;
+    unsigned long gp;
+    bool online;
+
+    // Calling thread cannot pass through a quiescent state while waiting
+    online = rcu_reader.registered &&
+        atomic_load_explicit(&rcu_reader.ctr, memory_order_relaxed) != RCU_GP_OFFLINE;
+    if (online) {
+        rcu_thread_offline();
+    }
+
+    pthread_mutex_lock(&rcu_gp_lock);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    gp = rcu_gp_next(atomic_load_explicit(&rcu_gp_ctr, memory_order_relaxed));
+    atomic_store_explicit(&rcu_gp_ctr, gp, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // The registry head is not embedded in a reader, so only convert nodes
+    list_for_each(pos, &rcu_registry) {
+        rcu_wait_for_reader(list_entry(pos, struct rcu_reader, node), gp);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    atomic_store_explicit(&rcu_gp_done, gp, memory_order_release);
+
+    pthread_mutex_unlock(&rcu_gp_lock);
+
+    if (online) {
+        rcu_thread_online();
+    }
+}
+
+unsigned long get_state_synchronize_rcu(void) {
+    // A grace period already in progress may have missed the unlinking
+    atomic_thread_fence(memory_order_seq_cst);
+    return rcu_gp_next(atomic_load_explicit(&rcu_gp_ctr, memory_order_relaxed));
+}
+
+bool poll_state_synchronize_rcu(unsigned long state) {
+    unsigned long done = atomic_load_explicit(&rcu_gp_done, memory_order_acquire);
+
+    // Grace periods are compared by distance, so that they may wrap around
+    return (long)(done - state) >= 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sharded_htable.h"
+
+#include <pthread.h>
+
+/** Merge worker */
+struct sharded_htable_worker {
+    pthread_t thread;
+    struct sharded_htable *table;
+    /** Index of the worker, it handles every nthreads-th shard or partition */
+    size_t id;
+    size_t nthreads;
+    sharded_htable_merge_f fn;
+    void *arg;
+};
+
+static void *sharded_htable_split_worker(void *arg) {
+    struct sharded_htable_worker *w = arg;
+
+    for (size_t i = w->id; i < w->table->nshards; i += w->nthreads) {
+        sharded_htable_split(w->table, i);
+    }
+    return NULL;
+}
+
+static void *sharded_htable_merge_worker(void *arg) {
+    struct sharded_htable_worker *w = arg;
+
+    for (size_t i = w->id; i < w->table->nparts; i += w->nthreads) {
+        sharded_htable_merge_part(w->table, i, w->fn, w->arg);
+    }
+    return NULL;
+}
+
+/**
+ * Run a function on all workers, the calling thread being the first one.
+ */
+static void sharded_htable_run(struct sharded_htable_worker *workers, size_t nthreads, void *(*fn)(void *)) {
+    size_t started;
+
+    for (started = 1; started < nthreads; ++started) {
+        if (pthread_create(&workers[started].thread, NULL, fn, &workers[started])) {
+            break;
+        }
+    }
+    // Work of threads which failed to start is done by the calling thread
+    for (size_t i = started; i < nthreads; ++i) {
+        fn(&workers[i]);
+    }
+    fn(&workers[0]);
+
+    for (size_t i = 1; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+int sharded_htable_merge(struct sharded_htable *table, size_t nthreads, sharded_htable_merge_f fn, void *arg) {
+    struct sharded_htable_worker *workers;
+
+    nthreads = clamp_t(size_t, nthreads, 1, max_t(size_t, table->nshards, table->nparts));
+    if (!(workers = calloc(nthreads, sizeof(*workers)))) {
+        return -1;
+    }
+    for (size_t i = 0; i < nthreads; ++i) {
+        workers[i] = (struct sharded_htable_worker){
+            .table = table, .id = i, .nthreads = nthreads, .fn = fn, .arg = arg
+        };
+    }
+
+    // All shards must be split before any partition collects its lists
+    sharded_htable_run(workers, nthreads, sharded_htable_split_worker);
+    sharded_htable_run(workers, nthreads, sharded_htable_merge_worker);
+
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bloom.h"
+#include "jhash.h"
+#include "test.h"
+
+#define NUM_KEYS 4096
+
+static uint32_t hash_of(uint32_t i) {
+  return jhash(&i, sizeof(i), 0);
+}
+
+static void test_no_false_negatives(void) {
+  struct bloom bloom;
+
+  for (int counting = 0; counting < 2; ++counting) {
+    check(bloom_init(&bloom, 16, counting) == 0);
+    check(bloom_saturation(&bloom) == 0);
+    check(bloom_fp_rate(&bloom) == 0);
+
+    for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+      bloom_add(&bloom, hash_of(i));
+    }
+    for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+      check(bloom_test(&bloom, hash_of(i)));
+    }
+    bloom_destroy(&bloom);
+  }
+}
+
+static void test_fp_rate(void) {
+  struct bloom bloom;
+  size_t positives = 0, tests = 100000;
+  double saturation, estimate, measured;
+
+  // 16 bits per key
+  bloom_init(&bloom, 16, false);
+  for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+    bloom_add(&bloom, hash_of(i));
+  }
+
+  // At most BLOOM_NUM_HASHES bits per key, fewer when they coincide
+  saturation = bloom_saturation(&bloom);
+  check(saturation > 0 && saturation <= (double)NUM_KEYS * BLOOM_NUM_HASHES / bloom_size(&bloom));
+
+  for (uint32_t i = NUM_KEYS; i < NUM_KEYS + tests; ++i) {
+    positives += bloom_test(&bloom, hash_of(i));
+  }
+  estimate = bloom_fp_rate(&bloom);
+  measured = (double)positives / tests;
+  check(estimate > 0 && estimate < 0.05);
+  check(measured < estimate * 1.5 + 0.001 && measured > estimate * 0.5 - 0.001);
+
+  bloom_destroy(&bloom);
+}
+
+static void test_counting_del(void) {
+  struct bloom bloom;
+
+  bloom_init(&bloom, 16, true);
+  for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+    bloom_add(&bloom, hash_of(i));
+  }
+
+  // Removing keys never hides the remaining ones
+  for (uint32_t i = 0; i < NUM_KEYS; i += 2) {
+    bloom_del(&bloom, hash_of(i));
+  }
+  for (uint32_t i = 1; i < NUM_KEYS; i += 2) {
+    check(bloom_test(&bloom, hash_of(i)));
+  }
+
+  for (uint32_t i = 1; i < NUM_KEYS; i += 2) {
+    bloom_del(&bloom, hash_of(i));
+  }
+  check(bloom_saturation(&bloom) == 0);
+  for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+    check(!bloom_test(&bloom, hash_of(i)));
+  }
+
+  bloom_destroy(&bloom);
+}
+
+static void test_counting_saturation(void) {
+  struct bloom bloom;
+  uint32_t hash = hash_of(42);
+
+  // Saturated counters no longer count, so they must stay set
+  bloom_init(&bloom, 16, true);
+  for (int i = 0; i < BLOOM_COUNTER_MAX + 10; ++i) {
+    bloom_add(&bloom, hash);
+  }
+  for (int i = 0; i < BLOOM_COUNTER_MAX + 10; ++i) {
+    bloom_del(&bloom, hash);
+  }
+  check(bloom_test(&bloom, hash));
+
+  bloom_destroy(&bloom);
+}
+
+int main(void) {
+  run_test(test_no_false_negatives);
+  run_test(test_fp_rate);
+  run_test(test_counting_del);
+  run_test(test_counting_saturation);
+  return 0;
+}
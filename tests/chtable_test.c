@@ -0,0 +1,151 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chtable.h"
+#include "test.h"
+
+#include <pthread.h>
+
+/* Number of entries present during the whole concurrent test */
+#define NUM_FIXED 1000
+/* Number of entries each writer adds and removes */
+#define NUM_CHURN 20000
+#define NUM_READERS 3
+#define NUM_WRITERS 2
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+};
+
+static struct item fixed[NUM_FIXED];
+static struct item churn[NUM_WRITERS][NUM_CHURN];
+static struct chtable table;
+static _Atomic(bool) done;
+
+static void test_single_thread(void) {
+  struct item *it;
+
+  chtable_init_n(&table, 4, 2);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    fixed[i].key = i;
+    chtable_add(&table, &fixed[i].entry, &fixed[i].key, sizeof(uint64_t));
+  }
+  check(chtable_count(&table) == NUM_FIXED);
+  check(table.bucks->size > 4);
+
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    it = chash_find_entry(&table, &fixed[i].key, sizeof(uint64_t), struct item, entry);
+    check(it == &fixed[i]);
+  }
+
+  for (size_t i = 0; i < NUM_FIXED; i += 2) {
+    check(chtable_del_key(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+    check(chtable_del_entry(&table, &fixed[i + 1].entry) == &fixed[i + 1].entry);
+    check(chtable_del_entry(&table, &fixed[i + 1].entry) == NULL);
+  }
+  check(chtable_count(&table) == 0);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    check(chtable_find(&table, &fixed[i].key, sizeof(uint64_t)) == NULL);
+  }
+
+  chtable_destroy(&table);
+}
+
+static void *reader(void *arg) {
+  uint64_t state = (uintptr_t)arg + 1;
+  size_t rounds = 0;
+
+  // Keep reading until the writers are done, at least a few times over
+  while (!atomic_load(&done) || rounds < 3) {
+    for (size_t i = 0; i < NUM_FIXED; ++i) {
+      struct item *it = &churn[test_rand(&state) % NUM_WRITERS][test_rand(&state) % NUM_CHURN];
+      struct htable_entry *e;
+
+      check(chtable_find(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+      // Entries being added or removed are either found whole or not at all
+      e = chtable_find(&table, &it->key, sizeof(uint64_t));
+      check(e == NULL || e == &it->entry);
+    }
+    rounds++;
+  }
+  return NULL;
+}
+
+static void *writer(void *arg) {
+  struct item *items = churn[(uintptr_t)arg];
+
+  // Removed entries are never reused, so no grace period is needed
+  for (size_t i = 0; i < NUM_CHURN; ++i) {
+    chtable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    if (i % 3 == 2) {
+      check(chtable_del_key(&table, &items[i - 2].key, sizeof(uint64_t)) == &items[i - 2].entry);
+      check(chtable_del_entry(&table, &items[i - 1].entry) == &items[i - 1].entry);
+    }
+  }
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  pthread_t readers[NUM_READERS], writers[NUM_WRITERS];
+  size_t size;
+
+  // Start small, so that the writers grow the table under the readers
+  chtable_init_n(&table, 4, 4);
+  size = table.bucks->size;
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    fixed[i].key = i;
+    chtable_add(&table, &fixed[i].entry, &fixed[i].key, sizeof(uint64_t));
+  }
+  for (size_t w = 0; w < NUM_WRITERS; ++w) {
+    for (size_t i = 0; i < NUM_CHURN; ++i) {
+      churn[w][i].key = ((uint64_t)(w + 1) << 32) | i;
+    }
+  }
+  atomic_init(&done, false);
+
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    check(pthread_create(&readers[i], NULL, reader, (void *)(uintptr_t)i) == 0);
+  }
+  for (size_t i = 0; i < NUM_WRITERS; ++i) {
+    check(pthread_create(&writers[i], NULL, writer, (void *)(uintptr_t)i) == 0);
+  }
+  for (size_t i = 0; i < NUM_WRITERS; ++i) {
+    pthread_join(writers[i], NULL);
+  }
+  atomic_store(&done, true);
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+
+  check(table.bucks->size > size);
+  check(chtable_count(&table) == NUM_FIXED + NUM_WRITERS * (NUM_CHURN / 3 + NUM_CHURN % 3));
+  for (size_t w = 0; w < NUM_WRITERS; ++w) {
+    for (size_t i = 0; i < NUM_CHURN; ++i) {
+      bool present = i % 3 == 2 || i >= NUM_CHURN / 3 * 3;
+      check(chtable_find(&table, &churn[w][i].key, sizeof(uint64_t)) == (present ? &churn[w][i].entry : NULL));
+    }
+  }
+
+  chtable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_single_thread);
+  run_test(test_concurrent);
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cuckoo_htable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+
+struct item {
+  uint64_t key;
+  bool present;
+  struct cuckoo_htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check that exactly the present items are found, each stored in one of its buckets.
+ */
+static void check_contents(const struct cuckoo_htable *table) {
+  struct cuckoo_htable_entry *pos;
+  struct item *it;
+  size_t count = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct cuckoo_htable_entry *e = cuckoo_htable_find(table, &items[i].key, sizeof(uint64_t));
+    check(e == (items[i].present ? &items[i].entry : NULL));
+    count += items[i].present;
+  }
+  check(table->count == count);
+
+  cuckoo_htable_for_each_entry(it, pos, table, entry) {
+    size_t buck = i / CUCKOO_HTABLE_WAYS;
+
+    check(it->present);
+    check(buck == cuckoo_which_bucket(table, pos->hash[0]) || buck == cuckoo_which_bucket(table, pos->hash[1]));
+    visited++;
+  }
+  check(visited == count);
+}
+
+static void test_displacement(void) {
+  struct cuckoo_htable table;
+  size_t size;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  // Fill a table of fixed size up to its maximum load, which needs entries
+  // to be moved to their other bucket
+  cuckoo_htable_init_n(&table, 1024);
+  size = table.size;
+  for (size_t i = 0; (i + 1) * 16 <= size * CUCKOO_HTABLE_WAYS * CUCKOO_HTABLE_MAX_LOAD; ++i) {
+    check(cuckoo_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0);
+    items[i].present = true;
+  }
+  check(table.size == size);
+  check_contents(&table);
+
+  cuckoo_htable_destroy(&table);
+}
+
+static void test_grow(void) {
+  struct cuckoo_htable table;
+
+  cuckoo_htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i * 0x9e3779b97f4a7c15ULL;
+    items[i].present = true;
+    check(cuckoo_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0);
+  }
+  check_contents(&table);
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    check(cuckoo_htable_del_key(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+    items[i].present = false;
+  }
+  check(cuckoo_htable_del_entry(&table, &items[0].entry) == NULL);
+  check_contents(&table);
+
+  cuckoo_htable_destroy(&table);
+}
+
+static void test_duplicates(void) {
+  struct cuckoo_htable table;
+  size_t size;
+  int added = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = 42;
+    items[i].present = false;
+  }
+
+  // Only the two buckets of the key can hold its entries, whatever the size
+  cuckoo_htable_init_n(&table, 1024);
+  size = table.size;
+  for (size_t i = 0; i < 4 * CUCKOO_HTABLE_WAYS; ++i) {
+    if (cuckoo_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0) {
+      added++;
+    }
+  }
+  check(added >= CUCKOO_HTABLE_WAYS && added <= 2 * CUCKOO_HTABLE_WAYS);
+  check(table.count == (size_t)added);
+  check(table.size == size);
+
+  cuckoo_htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_displacement);
+  run_test(test_grow);
+  run_test(test_duplicates);
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flat_htable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+
+struct item {
+  uint64_t key;
+  bool present;
+  struct flat_htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check that exactly the present items are found, each visited once.
+ */
+static void check_contents(const struct flat_htable *table) {
+  struct flat_htable_entry *pos;
+  size_t count = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct flat_htable_entry *e = flat_htable_find(table, &items[i].key, sizeof(uint64_t));
+    check(e == (items[i].present ? &items[i].entry : NULL));
+    count += items[i].present;
+  }
+  check(table->count == count);
+
+  flat_htable_for_each(pos, table) {
+    check(flat_hash_entry(pos, struct item, entry)->present);
+    visited++;
+  }
+  check(visited == count);
+}
+
+static void test_grow(void) {
+  struct flat_htable table;
+
+  flat_htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(flat_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0);
+    items[i].present = true;
+    check(table.count * 16 <= table.size * FLAT_HTABLE_MAX_LOAD);
+  }
+  check_contents(&table);
+
+  flat_htable_destroy(&table);
+}
+
+static void test_churn(void) {
+  struct flat_htable table;
+  uint64_t state = 1;
+  size_t size;
+
+  flat_htable_init_n(&table, 1024);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  // Deleted slots are reclaimed, so a table of constant population stays small
+  for (size_t op = 0; op < 40 * NUM_ITEMS; ++op) {
+    struct item *it = &items[test_rand(&state) % 512];
+
+    if (it->present) {
+      if (op & 1) {
+        check(flat_htable_del_key(&table, &it->key, sizeof(uint64_t)) == &it->entry);
+      } else {
+        check(flat_htable_del_entry(&table, &it->entry) == &it->entry);
+      }
+      it->present = false;
+    } else {
+      check(flat_htable_add(&table, &it->entry, &it->key, sizeof(uint64_t)) == 0);
+      it->present = true;
+    }
+    if (op % 50000 == 0) {
+      check_contents(&table);
+    }
+  }
+  size = table.size;
+  check_contents(&table);
+  check(size <= 1024);
+
+  flat_htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_grow);
+  run_test(test_churn);
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "htable_file.h"
+#include "test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define NUM_ITEMS 20000
+/* Number of values stored for each key of the multimap */
+#define NUM_DUPS 4
+
+struct item {
+  uint64_t key;
+  uint64_t value;
+  struct htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+static char dir[] = "htable_file_test.XXXXXX";
+static char path[sizeof(dir) + 16];
+
+static const void *item_value(const struct htable_entry *entry, size_t *len, void *arg) {
+  struct item *it = hash_entry(entry, struct item, entry);
+
+  *len = sizeof(it->value);
+  return &it->value;
+}
+
+static void test_round_trip(void) {
+  struct htable table;
+  struct htable_file file;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i * 0x9e3779b97f4a7c15ULL;
+    items[i].value = i;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(htable_file_build(&table, path, item_value, NULL) == 0);
+  htable_destroy(&table);
+
+  check(htable_file_open(&file, path) == 0);
+  check(htable_file_count(&file) == NUM_ITEMS);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    const struct htable_file_entry *e = htable_file_find(&file, &items[i].key, sizeof(uint64_t));
+    uint64_t key = items[i].key + 1;
+
+    check(e != NULL);
+    check(e->keylen == sizeof(uint64_t) && e->vallen == sizeof(uint64_t));
+    check(memcmp(htable_file_key(e), &items[i].key, sizeof(uint64_t)) == 0);
+    check(*(const uint64_t *)htable_file_value(e) == i);
+    check(htable_file_find(&file, &key, sizeof(uint64_t)) == NULL);
+    // A prefix of a key is a different key
+    check(htable_file_find(&file, &items[i].key, sizeof(uint32_t)) == NULL);
+  }
+  htable_file_close(&file);
+
+  // Without values, only keys are stored
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(htable_file_build(&table, path, NULL, NULL) == 0);
+  htable_destroy(&table);
+
+  check(htable_file_open(&file, path) == 0);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    const struct htable_file_entry *e = htable_file_find(&file, &items[i].key, sizeof(uint64_t));
+    check(e && e->vallen == 0);
+  }
+  htable_file_close(&file);
+}
+
+static void test_multimap(void) {
+  struct htable table;
+  struct htable_file file;
+  size_t found[NUM_ITEMS / NUM_DUPS] = { 0 };
+
+  htable_init_flags(&table, 0, HTABLE_MULTIMAP);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i / NUM_DUPS;
+    items[i].value = i;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(htable_file_build(&table, path, item_value, NULL) == 0);
+  htable_destroy(&table);
+
+  check(htable_file_open(&file, path) == 0);
+  check(htable_file_count(&file) == NUM_ITEMS);
+  // Every entry is stored, so all values of a key are in its bucket
+  for (size_t b = 0; b < file.size; ++b) {
+    for (uint64_t off = file.bucks[b]; off < file.bucks[b + 1];) {
+      const struct htable_file_entry *e = (const struct htable_file_entry *)(file.base + off);
+      uint64_t key, value;
+
+      memcpy(&key, htable_file_key(e), sizeof(key));
+      memcpy(&value, htable_file_value(e), sizeof(value));
+      check(value / NUM_DUPS == key);
+      found[key]++;
+      off += __htable_file_entry_size(e->keylen, e->vallen);
+    }
+  }
+  for (size_t k = 0; k < NUM_ITEMS / NUM_DUPS; ++k) {
+    const struct htable_file_entry *e = htable_file_find(&file, &k, sizeof(uint64_t));
+
+    check(found[k] == NUM_DUPS);
+    check(e && *(const uint64_t *)htable_file_value(e) / NUM_DUPS == k);
+  }
+  htable_file_close(&file);
+}
+
+static void test_empty(void) {
+  struct htable table;
+  struct htable_file file;
+  uint64_t key = 0;
+
+  htable_init(&table);
+  check(htable_file_build(&table, path, item_value, NULL) == 0);
+  htable_destroy(&table);
+
+  check(htable_file_open(&file, path) == 0);
+  check(htable_file_count(&file) == 0);
+  check(htable_file_find(&file, &key, sizeof(key)) == NULL);
+  check(htable_file_find(&file, "", 0) == NULL);
+  htable_file_close(&file);
+}
+
+/**
+ * Check that the file is rejected once given header field is overwritten.
+ */
+static void check_corrupt(size_t offset, const void *val, size_t len) {
+  struct htable_file file;
+  uint8_t saved[8];
+  int fd;
+
+  check((fd = open(path, O_RDWR)) >= 0);
+  check(pread(fd, saved, len, offset) == (ssize_t)len);
+  check(pwrite(fd, val, len, offset) == (ssize_t)len);
+
+  errno = 0;
+  check(htable_file_open(&file, path) == -1);
+  check(errno == EINVAL);
+
+  check(pwrite(fd, saved, len, offset) == (ssize_t)len);
+  close(fd);
+  check(htable_file_open(&file, path) == 0);
+  htable_file_close(&file);
+}
+
+static void test_reject(void) {
+  struct htable table;
+  struct htable_file file;
+  struct stat st;
+  uint32_t u32;
+  uint64_t u64;
+
+  htable_init(&table);
+  for (size_t i = 0; i < 100; ++i) {
+    items[i].key = i;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(htable_file_build(&table, path, NULL, NULL) == 0);
+  htable_destroy(&table);
+  check(stat(path, &st) == 0);
+
+  // Only the header is validated, entries are trusted
+  u32 = ~HTABLE_FILE_MAGIC;
+  check_corrupt(offsetof(struct htable_file_header, magic), &u32, sizeof(u32));
+  u32 = HTABLE_FILE_VERSION + 1;
+  check_corrupt(offsetof(struct htable_file_header, version), &u32, sizeof(u32));
+  u64 = 0;
+  check_corrupt(offsetof(struct htable_file_header, size), &u64, sizeof(u64));
+  u64 = 3;
+  check_corrupt(offsetof(struct htable_file_header, size), &u64, sizeof(u64));
+  u64 = 1ULL << 40;
+  check_corrupt(offsetof(struct htable_file_header, size), &u64, sizeof(u64));
+  u64 = sizeof(struct htable_file_header) + 4;
+  check_corrupt(offsetof(struct htable_file_header, bucks), &u64, sizeof(u64));
+  u64 = st.st_size + 8;
+  check_corrupt(offsetof(struct htable_file_header, bucks), &u64, sizeof(u64));
+  u64 = st.st_size - 1;
+  check_corrupt(offsetof(struct htable_file_header, len), &u64, sizeof(u64));
+
+  // The end of the last bucket lies beyond the file
+  check(htable_file_open(&file, path) == 0);
+  u64 = file.bucks[file.size] + 1;
+  check_corrupt((const uint8_t *)&file.bucks[file.size] - file.base, &u64, sizeof(u64));
+  htable_file_close(&file);
+
+  // Truncated files no longer match the length in the header
+  check(truncate(path, st.st_size - 1) == 0);
+  errno = 0;
+  check(htable_file_open(&file, path) == -1 && errno == EINVAL);
+  check(truncate(path, sizeof(struct htable_file_header) - 1) == 0);
+  errno = 0;
+  check(htable_file_open(&file, path) == -1 && errno == EINVAL);
+  check(truncate(path, 0) == 0);
+  errno = 0;
+  check(htable_file_open(&file, path) == -1 && errno == EINVAL);
+
+  check(unlink(path) == 0);
+  check(htable_file_open(&file, path) == -1 && errno == ENOENT);
+}
+
+int main(void) {
+  check(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/table", dir);
+
+  run_test(test_round_trip);
+  run_test(test_multimap);
+  run_test(test_empty);
+  run_test(test_reject);
+
+  check(rmdir(dir) == 0);
+  return 0;
+}
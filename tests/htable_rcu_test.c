@@ -0,0 +1,193 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "htable.h"
+#include "rcu.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Number of entries present during the whole concurrent test */
+#define NUM_FIXED 1000
+/* Number of entries the writer adds and removes in each round */
+#define NUM_CHURN 20000
+#define NUM_ROUNDS 3
+#define NUM_READERS 3
+/* Number of writer operations between yielding the processor */
+#define YIELD_INTERVAL 256
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+};
+
+static struct item fixed[NUM_FIXED];
+static struct item churn[NUM_CHURN];
+static struct htable table;
+static _Atomic(bool) done;
+
+static void test_poll_state(void) {
+  unsigned long state;
+
+  rcu_register_thread();
+  state = get_state_synchronize_rcu();
+  check(!poll_state_synchronize_rcu(state));
+  rcu_quiescent_state();
+  check(!poll_state_synchronize_rcu(state));
+  synchronize_rcu();
+  check(poll_state_synchronize_rcu(state));
+
+  // Grace periods which elapsed earlier do not count for newer cookies
+  state = get_state_synchronize_rcu();
+  check(!poll_state_synchronize_rcu(state));
+  synchronize_rcu();
+  check(poll_state_synchronize_rcu(state));
+  rcu_unregister_thread();
+}
+
+static void test_reclaim(void) {
+  struct htable_entry *e;
+
+  htable_init_n(&table, 4);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    fixed[i].key = i;
+    htable_add_rcu(&table, &fixed[i].entry, &fixed[i].key, sizeof(uint64_t));
+  }
+  // Replaced buckets are kept around rather than waiting for a grace period
+  check(table.retired != NULL);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    check(htable_find_rcu(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+  }
+
+  synchronize_rcu();
+  htable_reclaim_rcu(&table);
+  check(table.retired == NULL);
+
+  for (size_t i = 0; i < NUM_FIXED; i += 2) {
+    check(htable_del_key_rcu(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+    check(htable_del_entry_rcu(&table, &fixed[i + 1].entry) == &fixed[i + 1].entry);
+    check(htable_del_entry_rcu(&table, &fixed[i + 1].entry) == NULL);
+  }
+  check(table.count == 0);
+  htable_for_each(e, &table) {
+    check(false);
+  }
+
+  // Arrays still waiting for a grace period are freed with the table
+  htable_destroy(&table);
+}
+
+static void *reader(void *arg) {
+  uint64_t state = (uintptr_t)arg + 1;
+  size_t rounds = 0;
+
+  rcu_register_thread();
+  // Keep reading until the writer is done, at least a few times over
+  while (!atomic_load(&done) || rounds < 3) {
+    for (size_t i = 0; i < NUM_FIXED; ++i) {
+      struct item *it = &churn[test_rand(&state) % NUM_CHURN];
+      struct htable_entry *e;
+
+      check(htable_find_rcu(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+      // Entries being added or removed are either found whole or not at all
+      e = htable_find_rcu(&table, &it->key, sizeof(uint64_t));
+      check(e == NULL || e == &it->entry);
+    }
+    rcu_quiescent_state();
+    rounds++;
+  }
+  rcu_unregister_thread();
+  return NULL;
+}
+
+static void *writer(void *arg) {
+  size_t grown = 0, shrunk = 0;
+
+  for (size_t r = 0; r < NUM_ROUNDS; ++r) {
+    size_t size = table.size;
+
+    for (size_t i = 0; i < NUM_CHURN; ++i) {
+      htable_add_rcu(&table, &churn[i].entry, &churn[i].key, sizeof(uint64_t));
+      // Let the readers run in between, even on a single processor
+      if (i % YIELD_INTERVAL == 0) {
+        sched_yield();
+      }
+    }
+    grown += table.size > size;
+    size = table.size;
+    for (size_t i = 0; i < NUM_CHURN; i += 2) {
+      check(htable_del_key_rcu(&table, &churn[i].key, sizeof(uint64_t)) == &churn[i].entry);
+      check(htable_del_entry_rcu(&table, &churn[i + 1].entry) == &churn[i + 1].entry);
+    }
+    shrunk += table.size < size;
+
+    // Removed entries may only be added again once no reader sees them
+    synchronize_rcu();
+  }
+
+  check(grown == NUM_ROUNDS);
+  check(shrunk == NUM_ROUNDS);
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  pthread_t readers[NUM_READERS], w;
+
+  // Start small, so that the writer resizes the table under the readers
+  htable_init_n(&table, 4);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    fixed[i].key = i;
+    htable_add_rcu(&table, &fixed[i].entry, &fixed[i].key, sizeof(uint64_t));
+  }
+  for (size_t i = 0; i < NUM_CHURN; ++i) {
+    churn[i].key = (1ULL << 32) | i;
+  }
+  atomic_init(&done, false);
+
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    check(pthread_create(&readers[i], NULL, reader, (void *)(uintptr_t)i) == 0);
+  }
+  check(pthread_create(&w, NULL, writer, NULL) == 0);
+  pthread_join(w, NULL);
+  atomic_store(&done, true);
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+
+  check(table.count == NUM_FIXED);
+  for (size_t i = 0; i < NUM_FIXED; ++i) {
+    check(htable_find_rcu(&table, &fixed[i].key, sizeof(uint64_t)) == &fixed[i].entry);
+  }
+  for (size_t i = 0; i < NUM_CHURN; ++i) {
+    check(htable_find_rcu(&table, &churn[i].key, sizeof(uint64_t)) == NULL);
+  }
+
+  // The writer ran a grace period after its last resize
+  htable_reclaim_rcu(&table);
+  check(table.retired == NULL);
+
+  htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_poll_state);
+  run_test(test_reclaim);
+  run_test(test_concurrent);
+  return 0;
+}
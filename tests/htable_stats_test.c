@@ -0,0 +1,90 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define HTABLE_STATS
+
+#include "htable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+static void test_counters(void) {
+  static const void *keys[NUM_ITEMS];
+  static size_t lens[NUM_ITEMS];
+  static struct htable_entry *out[NUM_ITEMS];
+  struct htable table;
+  struct htable_stats stats;
+  size_t lookups;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  htable_rehash_step(&table, table.old_size);
+  htable_stats(&table, &stats);
+  check(stats.lookups == 0);
+  check(stats.probes_per_lookup == 0);
+
+  // Keys present are never rejected and take at least one probe each
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(htable_find(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+  }
+  htable_stats(&table, &stats);
+  check(stats.lookups == NUM_ITEMS);
+  check(table.probes >= NUM_ITEMS);
+  check(stats.probes_per_lookup >= 1);
+  check(table.bloom_rejects == 0);
+  check(stats.bloom_reject_rate == 0);
+
+  // Most absent keys are rejected by the filter without any probe
+  for (uint64_t key = NUM_ITEMS; key < 2 * NUM_ITEMS; ++key) {
+    check(htable_find(&table, &key, sizeof(uint64_t)) == NULL);
+  }
+  htable_stats(&table, &stats);
+  check(stats.lookups == 2 * NUM_ITEMS);
+  check(table.bloom_rejects > NUM_ITEMS / 2 && table.bloom_rejects <= NUM_ITEMS);
+  check(stats.bloom_reject_rate > 0.25 && stats.bloom_reject_rate <= 0.5);
+
+  // Batched lookups count as well
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    keys[i] = &items[i].key;
+    lens[i] = sizeof(uint64_t);
+  }
+  lookups = table.lookups;
+  check(htable_find_batch(&table, keys, lens, NUM_ITEMS, out) == NUM_ITEMS);
+  check(table.lookups == lookups + NUM_ITEMS);
+
+  // Lookups under RCU are not counted
+  check(htable_find_rcu(&table, &items[0].key, sizeof(uint64_t)) == &items[0].entry);
+  check(table.lookups == lookups + NUM_ITEMS);
+
+  htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_counters);
+  return 0;
+}
@@ -0,0 +1,677 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "htable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+
+struct item {
+  uint64_t key;
+  bool present;
+  struct htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check that exactly the present items are found, each visited once.
+ */
+static void check_contents(const struct htable *table) {
+  struct htable_entry *pos;
+  size_t count = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct htable_entry *e = htable_find(table, &items[i].key, sizeof(uint64_t));
+    check(e == (items[i].present ? &items[i].entry : NULL));
+    check(htable_find_8(table, &items[i].key) == e);
+    count += items[i].present;
+  }
+  check(table->count == count);
+
+  htable_for_each(pos, table) {
+    check(hash_entry(pos, struct item, entry)->present);
+    visited++;
+  }
+  check(visited == count);
+}
+
+static void test_init_size(void) {
+  struct htable table;
+
+  htable_init_n(&table, 101);
+  check(table.size == 128);
+  htable_destroy(&table);
+
+  htable_init_n(&table, (size_t)1 << 33 >> 20);
+  check(table.size == (size_t)1 << 13);
+  htable_destroy(&table);
+
+  check(roundup_pow_of_two((size_t)1 << 40 | 1) == (size_t)1 << 41);
+}
+
+static void test_grow_incrementally(void) {
+  struct htable table;
+  size_t size;
+  bool rehashed = false;
+
+  htable_init(&table);
+  size = table.size;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i * 0x9e3779b97f4a7c15ULL;
+    items[i].present = false;
+  }
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].present = true;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+
+    check(table.count <= (table.size + table.old_size) * HASH_MAX_LOAD);
+    if (htable_rehashing(&table)) {
+      // Only a few buckets are migrated by each addition
+      check(table.rehash_idx <= table.old_size);
+      rehashed = true;
+      if (i % 97 == 0) {
+        check_contents(&table);
+      }
+    }
+  }
+  check(rehashed);
+  check(table.size > size);
+  check_contents(&table);
+
+  htable_destroy(&table);
+}
+
+static void test_shrink_on_delete(void) {
+  struct htable table;
+  size_t size;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = true;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  size = table.size;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    if (i % 10) {
+      check(htable_del_key(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+      items[i].present = false;
+    }
+    if (i % 1000 == 0) {
+      check_contents(&table);
+    }
+  }
+  check(htable_del_key(&table, &items[1].key, sizeof(uint64_t)) == NULL);
+  check(table.size < size);
+  check_contents(&table);
+
+  htable_destroy(&table);
+}
+
+static void test_reserve(void) {
+  struct htable table;
+  size_t size;
+
+  htable_init(&table);
+  check(htable_reserve(&table, NUM_ITEMS) == 0);
+  size = table.size;
+  check(size * HASH_MAX_LOAD >= NUM_ITEMS);
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = true;
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(table.size == size);
+
+  // Removing entries must not give up the reservation
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(htable_del_entry(&table, &items[i].entry) == &items[i].entry);
+    items[i].present = false;
+  }
+  check(table.size == size);
+  check_contents(&table);
+
+  check(htable_compact(&table) == 0);
+  check(table.size < size);
+
+  htable_destroy(&table);
+}
+
+/**
+ * Check that the entries present with given key form a single run.
+ */
+static void check_run(const struct htable *table, uint64_t key) {
+  struct htable_entry *first, *pos;
+  size_t count, present = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    present += items[i].present && items[i].key == key;
+  }
+
+  first = htable_find_all(table, &key, sizeof(uint64_t), &count);
+  check(count == present);
+  check(!first == !present);
+  if (first) {
+    check(first == htable_find(table, &key, sizeof(uint64_t)));
+    htable_for_each_dup(pos, first) {
+      struct item *it = hash_entry(pos, struct item, entry);
+      check(it->present && it->key == key);
+      visited++;
+    }
+  }
+  check(visited == present);
+}
+
+static void test_multimap(void) {
+  struct htable table;
+  bool rehashed = false;
+
+  htable_init_flags(&table, 0, HTABLE_MULTIMAP);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i % 500;
+    items[i].present = false;
+  }
+
+  // Runs must stay together while buckets are migrated
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    items[i].present = true;
+    if (htable_rehashing(&table) && i % 7 == 0) {
+      rehashed = true;
+      check_run(&table, i % 500);
+      check_run(&table, (i * 31) % 500);
+    }
+  }
+  check(rehashed);
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 3) {
+    check(htable_del_entry(&table, &items[i].entry) == &items[i].entry);
+    items[i].present = false;
+  }
+  for (uint64_t key = 0; key < 500; ++key) {
+    check_run(&table, key);
+  }
+
+  htable_destroy(&table);
+}
+
+static void test_bloom_counting(void) {
+  struct htable table;
+  struct htable_stats stats;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  // The filter is rebuilt whenever the table grows or shrinks
+  htable_init_flags(&table, 0, HTABLE_BLOOM_COUNTING);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    items[i].present = true;
+  }
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    check(htable_del_key(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+    items[i].present = false;
+    if (i % 1000 == 0) {
+      check_contents(&table);
+    }
+  }
+  check_contents(&table);
+  htable_destroy(&table);
+
+  // Without resizing, removing all keys clears the filter
+  htable_init_flags(&table, NUM_ITEMS, HTABLE_BLOOM_COUNTING);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    items[i].present = true;
+  }
+  htable_stats(&table, &stats);
+  check(stats.bloom_saturation > 0);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(htable_del_entry(&table, &items[i].entry) == &items[i].entry);
+    items[i].present = false;
+  }
+  htable_stats(&table, &stats);
+  check(stats.bloom_saturation == 0);
+  check_contents(&table);
+
+  htable_destroy(&table);
+}
+
+static void test_mixed_load(void) {
+  struct htable table;
+  uint64_t state = 1;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  for (size_t op = 0; op < 20 * NUM_ITEMS; ++op) {
+    struct item *it = &items[test_rand(&state) % NUM_ITEMS];
+
+    if (it->present) {
+      if (op & 1) {
+        check(htable_del_key(&table, &it->key, sizeof(uint64_t)) == &it->entry);
+      } else {
+        check(htable_del_entry(&table, &it->entry) == &it->entry);
+      }
+      it->present = false;
+    } else {
+      htable_add(&table, &it->entry, &it->key, sizeof(uint64_t));
+      it->present = true;
+    }
+    if (op % 20000 == 0) {
+      check_contents(&table);
+    }
+  }
+  check_contents(&table);
+
+  htable_destroy(&table);
+}
+
+/**
+ * Check that batched lookups of all items agree with single lookups.
+ */
+static void check_batch(const struct htable *table) {
+  static const void *keys[NUM_ITEMS];
+  static size_t lens[NUM_ITEMS];
+  static struct htable_entry *out[NUM_ITEMS];
+  size_t found = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    keys[i] = &items[i].key;
+    lens[i] = sizeof(uint64_t);
+  }
+  // An odd number of keys leaves a partial group at the end
+  check(htable_find_batch(table, keys, lens, NUM_ITEMS - 1, out) == table->count - items[NUM_ITEMS - 1].present);
+  for (size_t i = 0; i < NUM_ITEMS - 1; ++i) {
+    check(out[i] == htable_find(table, keys[i], lens[i]));
+    found += out[i] != NULL;
+  }
+  check(found == table->count - items[NUM_ITEMS - 1].present);
+}
+
+static void test_find_batch(void) {
+  struct htable table;
+  size_t checked = 0;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  // Half of the keys are absent, while buckets are migrated as the table grows
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    items[i].present = true;
+    if (htable_rehashing(&table) && i % 64 == 0) {
+      check_batch(&table);
+      checked++;
+    }
+  }
+  check(checked > 0);
+  check_batch(&table);
+
+  // And as it shrinks again
+  checked = 0;
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    check(htable_del_key(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+    items[i].present = false;
+    if (htable_rehashing(&table) && i % 64 == 0) {
+      check_batch(&table);
+      checked++;
+    }
+  }
+  check(checked > 0);
+  check_batch(&table);
+
+  htable_destroy(&table);
+}
+
+/* Number of calls of test_hash() and the seed it was last called with */
+static size_t hash_calls;
+static uint32_t hash_seed;
+
+/**
+ * FNV-1a, starting from the seed.
+ */
+static uint32_t test_hash(const void *key, uint32_t len, uint32_t seed) {
+  const uint8_t *p = key;
+  uint32_t h = 2166136261u ^ seed;
+
+  hash_calls++;
+  hash_seed = seed;
+  for (uint32_t i = 0; i < len; ++i) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * Grow the table, checking that entries keep hashes computed with given
+ * function and seed.
+ */
+static void check_seed(struct htable *table, htable_hash_f hashfn, uint32_t seed) {
+  size_t size = table->size;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = true;
+    htable_add(table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  check(table->size > size);
+  check(table->seed == seed);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(items[i].entry.hash == hashfn(&items[i].key, sizeof(uint64_t), seed));
+  }
+  check_contents(table);
+}
+
+static void test_init_hash(void) {
+  struct htable table, other;
+  uint32_t seed;
+
+  // Custom hash function with explicit seed
+  htable_init_hash(&table, 0, 0, test_hash, 42);
+  check(table.seed == 42);
+  hash_calls = 0;
+  check_seed(&table, test_hash, 42);
+  check(hash_calls >= 2 * NUM_ITEMS);
+  check(hash_seed == 42);
+  htable_destroy(&table);
+
+  // The seed changes the hash of keys
+  htable_init_hash(&table, 0, 0, NULL, 42);
+  htable_init_hash(&other, 0, 0, NULL, 43);
+  items[0].key = 1;
+  check(__htable_hash(&table, &items[0].key, sizeof(uint64_t)) == jhash(&items[0].key, sizeof(uint64_t), 42));
+  check(__htable_hash(&table, &items[0].key, sizeof(uint64_t)) != __htable_hash(&other, &items[0].key, sizeof(uint64_t)));
+  htable_destroy(&other);
+  htable_destroy(&table);
+
+  // Random seed is ignored as argument and kept across resizes
+  htable_init_hash(&table, 0, HTABLE_RANDOM_SEED, NULL, 42);
+  htable_init_hash(&other, 0, HTABLE_RANDOM_SEED, NULL, 42);
+  seed = table.seed;
+  check(seed != other.seed);
+  check_seed(&table, jhash, seed);
+  htable_destroy(&other);
+  htable_destroy(&table);
+
+  // Random seed is passed to custom hash function
+  htable_init_hash(&table, 0, HTABLE_RANDOM_SEED, test_hash, 42);
+  seed = table.seed;
+  check_seed(&table, test_hash, seed);
+  check(hash_seed == seed);
+  htable_destroy(&table);
+}
+
+/* Number of items present during the whole scan */
+#define NUM_STABLE 2000
+/* Number of items added or removed between scan calls */
+#define SCAN_CHURN 128
+
+/* Number of times each item was visited by htable_scan() */
+static size_t visits[NUM_ITEMS];
+
+static void count_visit(struct htable_entry *entry, void *arg) {
+  visits[hash_entry(entry, struct item, entry) - items]++;
+}
+
+static void test_scan(void) {
+  struct htable table;
+  unsigned long cursor = 0;
+  size_t added = NUM_STABLE, removed = NUM_STABLE;
+  size_t size, max_size = 0;
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+    visits[i] = 0;
+  }
+  for (size_t i = 0; i < NUM_STABLE; ++i) {
+    htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t));
+    items[i].present = true;
+  }
+  size = table.size;
+
+  // Grow the table to several times its size and shrink it back mid-scan
+  do {
+    cursor = htable_scan(&table, cursor, 8, count_visit, NULL);
+    if (added < NUM_ITEMS) {
+      for (size_t n = 0; n < SCAN_CHURN && added < NUM_ITEMS; ++n, ++added) {
+        htable_add(&table, &items[added].entry, &items[added].key, sizeof(uint64_t));
+        items[added].present = true;
+      }
+    } else {
+      for (size_t n = 0; n < SCAN_CHURN && removed < NUM_ITEMS; ++n, ++removed) {
+        check(htable_del_key(&table, &items[removed].key, sizeof(uint64_t)) == &items[removed].entry);
+        items[removed].present = false;
+      }
+    }
+    max_size = max_t(size_t, max_size, table.size);
+  } while (cursor);
+
+  check(max_size > 4 * size);
+  check(removed == NUM_ITEMS);
+  check(table.size < max_size);
+  for (size_t i = 0; i < NUM_STABLE; ++i) {
+    check(visits[i] >= 1);
+  }
+  check_contents(&table);
+
+  // Without shrinking, no entry is visited twice
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    visits[i] = 0;
+  }
+  cursor = 0;
+  added = NUM_STABLE;
+  size = table.size;
+  do {
+    cursor = htable_scan(&table, cursor, 8, count_visit, NULL);
+    for (size_t n = 0; n < SCAN_CHURN && added < NUM_ITEMS; ++n, ++added) {
+      htable_add(&table, &items[added].entry, &items[added].key, sizeof(uint64_t));
+      items[added].present = true;
+    }
+  } while (cursor);
+  for (size_t i = 0; i < NUM_STABLE; ++i) {
+    check(visits[i] == 1);
+  }
+  for (size_t i = NUM_STABLE; i < NUM_ITEMS; ++i) {
+    check(visits[i] <= 1);
+  }
+  check(added == NUM_ITEMS);
+  check(table.size > size);
+  check_contents(&table);
+
+  htable_destroy(&table);
+}
+
+struct inline_item {
+  struct htable_inline_entry entry;
+  /** Buffer holding keys longer than HTABLE_INLINE_KEY */
+  char key[2 * HTABLE_INLINE_KEY];
+};
+
+/**
+ * Write key of given length for given index into buffer.
+ */
+static void make_key(char *buf, size_t i, size_t len) {
+  memset(buf, 'x', len);
+  for (size_t j = 0; j < len && j < 8; ++j, i /= 10) {
+    buf[j] = '0' + i % 10;
+  }
+}
+
+static void test_inline(void) {
+  static struct inline_item inline_items[NUM_ITEMS];
+  struct inline_item *it;
+  struct htable table;
+  char buf[2 * HTABLE_INLINE_KEY];
+
+  htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    // Key lengths from 8 bytes up to beyond the inline limit
+    size_t len = 8 + i % (HTABLE_INLINE_KEY + 2);
+
+    it = &inline_items[i];
+    if (len <= HTABLE_INLINE_KEY) {
+      // Short keys are copied, so the same buffer is reused for all of them
+      make_key(buf, i, len);
+      htable_add_inline(&table, &it->entry, buf, len);
+      check(it->entry.entry.key == it->entry.key);
+    } else {
+      // Long keys are pointed to and must outlive the entry
+      make_key(it->key, i, len);
+      htable_add_inline(&table, &it->entry, it->key, len);
+      check(it->entry.entry.key == it->key);
+    }
+  }
+  memset(buf, 0, sizeof(buf));
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    size_t len = 8 + i % (HTABLE_INLINE_KEY + 2);
+
+    make_key(buf, i, len);
+    check(hash_find_inline_entry(&table, buf, len, struct inline_item, entry) == &inline_items[i]);
+    // A prefix of a key is a different key
+    check(htable_find(&table, buf, len - 1) == NULL);
+  }
+
+  // Changing a long key in the caller's buffer changes the key in the table
+  it = &inline_items[HTABLE_INLINE_KEY + 1 - 8];
+  make_key(buf, it - inline_items, HTABLE_INLINE_KEY + 1);
+  check(htable_find(&table, buf, HTABLE_INLINE_KEY + 1) == &it->entry.entry);
+  it->key[HTABLE_INLINE_KEY] = 'y';
+  check(htable_find(&table, buf, HTABLE_INLINE_KEY + 1) == NULL);
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(htable_del_entry(&table, &inline_items[i].entry.entry) == &inline_items[i].entry.entry);
+  }
+  check(table.count == 0);
+
+  htable_destroy(&table);
+}
+
+static void test_build(void) {
+  static struct htable_entry *entries[NUM_ITEMS];
+  struct htable_entry *pos;
+  struct htable table;
+  size_t found = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i * 0x9e3779b97f4a7c15ULL;
+    items[i].present = true;
+    INIT_HTABLE_ENTRY(&items[i].entry, &items[i].key, sizeof(uint64_t));
+    entries[i] = &items[i].entry;
+  }
+
+  // Unique keys, the table sized once for all of them
+  htable_init(&table);
+  check(htable_build(&table, entries, NUM_ITEMS) == 0);
+  check(!htable_rehashing(&table));
+  check(table.count <= table.size * HASH_MAX_LOAD);
+  check_contents(&table);
+
+  // The table is used as usual afterwards
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    check(htable_del_key(&table, &items[i].key, sizeof(uint64_t)) == &items[i].entry);
+    items[i].present = false;
+  }
+  check_contents(&table);
+
+  // Building into a table which is not empty fails and leaves it intact
+  check(htable_build(&table, entries, NUM_ITEMS) == -1);
+  check(htable_build_hashed(&table, entries, NUM_ITEMS) == -1);
+  check_contents(&table);
+  htable_destroy(&table);
+
+  // Hashing apart from building, with keys repeated in a multimap
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i % 500;
+    items[i].present = true;
+    INIT_HTABLE_ENTRY(&items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  htable_init_flags(&table, 0, HTABLE_MULTIMAP);
+  htable_hash_entries(&table, entries, NUM_ITEMS / 2);
+  htable_hash_entries(&table, entries + NUM_ITEMS / 2, NUM_ITEMS - NUM_ITEMS / 2);
+  check(htable_build_hashed(&table, entries, NUM_ITEMS) == 0);
+  check(table.count == NUM_ITEMS);
+  for (uint64_t key = 0; key < 500; ++key) {
+    check_run(&table, key);
+  }
+  htable_for_each(pos, &table) {
+    found++;
+  }
+  check(found == NUM_ITEMS);
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 3) {
+    check(htable_del_entry(&table, &items[i].entry) == &items[i].entry);
+    items[i].present = false;
+  }
+  for (uint64_t key = 0; key < 500; key += 2) {
+    struct htable_entry *e;
+
+    while ((e = htable_del_key(&table, &key, sizeof(uint64_t)))) {
+      hash_entry(e, struct item, entry)->present = false;
+    }
+  }
+  for (uint64_t key = 0; key < 500; ++key) {
+    check_run(&table, key);
+  }
+  htable_destroy(&table);
+
+  // An empty table still being shrunk is migrated before building
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = true;
+    INIT_HTABLE_ENTRY(&items[i].entry, &items[i].key, sizeof(uint64_t));
+  }
+  htable_init_n(&table, 1024);
+  htable_resize(&table, 64);
+  check(htable_rehashing(&table) && table.count == 0);
+  check(htable_build(&table, entries, NUM_ITEMS) == 0);
+  check(!htable_rehashing(&table));
+  check_contents(&table);
+  htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_init_size);
+  run_test(test_grow_incrementally);
+  run_test(test_shrink_on_delete);
+  run_test(test_reserve);
+  run_test(test_multimap);
+  run_test(test_bloom_counting);
+  run_test(test_mixed_load);
+  run_test(test_find_batch);
+  run_test(test_init_hash);
+  run_test(test_scan);
+  run_test(test_inline);
+  run_test(test_build);
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ihtable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+/* Longest bucket chain expected with keys spread evenly */
+#define MAX_CHAIN 12
+
+struct item {
+  bool present;
+  struct ihtable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check that exactly the present items are found, each visited once.
+ */
+static void check_contents(const struct ihtable *table) {
+  struct item *it;
+  struct hlist_node *pos;
+  size_t count = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct ihtable_entry *e = ihtable_find(table, items[i].entry.key);
+    check(e == (items[i].present ? &items[i].entry : NULL));
+    count += items[i].present;
+  }
+  check(table->count == count);
+
+  ihtable_for_each_entry(it, pos, table, entry) {
+    check(it->present);
+    visited++;
+  }
+  check(visited == count);
+}
+
+static void test_high_bits(void) {
+  struct ihtable table;
+  size_t size;
+
+  ihtable_init(&table);
+  size = table.size;
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].entry.key = (uint64_t)i << 32;
+    items[i].present = false;
+  }
+
+  // Keys differing only above the low 32 bits must still spread and match
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].present = true;
+    ihtable_add(&table, &items[i].entry, (uint64_t)i << 32);
+    if (i % 1000 == 0) {
+      check_contents(&table);
+    }
+  }
+  check(table.size > size);
+  check(table.count <= table.size * IHASH_MAX_LOAD);
+  check_contents(&table);
+  for (size_t i = 0; i < table.size; ++i) {
+    struct hlist_node *pos;
+    size_t len = 0;
+
+    hlist_for_each(pos, &table.bucks[i]) {
+      len++;
+    }
+    check(len <= MAX_CHAIN);
+  }
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    check(ihtable_find(&table, (uint64_t)i << 32 | 1) == NULL);
+  }
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    check(ihtable_del_key(&table, (uint64_t)i << 32) == &items[i].entry);
+    check(ihtable_del_entry(&table, &items[i + 1].entry) == &items[i + 1].entry);
+    check(ihtable_del_entry(&table, &items[i + 1].entry) == NULL);
+    items[i].present = items[i + 1].present = false;
+  }
+  check(ihtable_del_key(&table, 0) == NULL);
+  check_contents(&table);
+
+  ihtable_destroy(&table);
+}
+
+static void test_extreme_keys(void) {
+  static const uint64_t keys[] = {0, 1, UINT64_MAX, UINT64_MAX - 1, 1ULL << 63};
+  struct ihtable table;
+
+  // A table of one bucket would need zero hash bits
+  ihtable_init_n(&table, 1);
+  check(table.bits > 0);
+  for (size_t i = 0; i < ARRAY_SIZE(keys); ++i) {
+    ihtable_add(&table, &items[i].entry, keys[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(keys); ++i) {
+    check(ihash_find_entry(&table, keys[i], struct item, entry) == &items[i]);
+  }
+  ihtable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_high_bits);
+  run_test(test_extreme_keys);
+  return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "interval_tree.h"
+#include "test.h"
+
+#include <stdbool.h>
+
+#define NUM_ITEMS 2000
+#define MAX_POINT 10000
+
+struct item {
+  bool present;
+  struct interval_tree_node node;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check red black properties and the greatest last kept in every node.
+ *
+ * @return black height of the subtree
+ */
+static int check_subtree(const struct rb_node *rb, const struct rb_node *parent, unsigned long *subtree_last) {
+  const struct interval_tree_node *node;
+  unsigned long left_last = 0, right_last = 0;
+  int lh, rh;
+
+  if (!rb) {
+    return 1;
+  }
+  node = rb_entry(rb, struct interval_tree_node, rb);
+  check(rb_parent(rb) == parent);
+  check(rb_is_black(rb) || !rb->rb_left || rb_is_black(rb->rb_left));
+  check(rb_is_black(rb) || !rb->rb_right || rb_is_black(rb->rb_right));
+  if (rb->rb_left) {
+    check(rb_entry(rb->rb_left, struct interval_tree_node, rb)->start <= node->start);
+  }
+  if (rb->rb_right) {
+    check(rb_entry(rb->rb_right, struct interval_tree_node, rb)->start >= node->start);
+  }
+
+  lh = check_subtree(rb->rb_left, rb, &left_last);
+  rh = check_subtree(rb->rb_right, rb, &right_last);
+  check(lh == rh);
+
+  *subtree_last = max(node->last, max(left_last, right_last));
+  check(node->__subtree_last == *subtree_last);
+
+  return lh + rb_is_black(rb);
+}
+
+static void check_tree(struct rb_root *root) {
+  unsigned long last;
+
+  check(!root->rb_node || rb_is_black(root->rb_node));
+  check_subtree(root->rb_node, NULL, &last);
+}
+
+/**
+ * Check that a query finds exactly the present items overlapping it, in order of start.
+ */
+static void check_query(struct rb_root *root, unsigned long start, unsigned long last) {
+  struct interval_tree_node *pos;
+  unsigned long prev = 0;
+  size_t expected = 0, found = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    expected += items[i].present && items[i].node.start <= last && items[i].node.last >= start;
+  }
+  interval_tree_for_each_overlap(pos, root, start, last) {
+    check(container_of(pos, struct item, node)->present);
+    check(pos->start <= last && pos->last >= start);
+    check(pos->start >= prev);
+    prev = pos->start;
+    found++;
+  }
+  check(found == expected);
+}
+
+static void test_insert_remove(void) {
+  struct rb_root root = RB_ROOT;
+  uint64_t state = 1;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].node.start = test_rand(&state) % MAX_POINT;
+    // Mostly short intervals with a few long ones
+    items[i].node.last = items[i].node.start + test_rand(&state) % (i % 16 ? 50 : MAX_POINT / 4);
+    items[i].present = true;
+    interval_tree_insert(&items[i].node, &root);
+    if (i % 100 == 0) {
+      check_tree(&root);
+    }
+  }
+  check_tree(&root);
+
+  for (size_t q = 0; q < 200; ++q) {
+    unsigned long start = test_rand(&state) % MAX_POINT;
+    check_query(&root, start, start + test_rand(&state) % 200);
+    check_query(&root, start, start);
+  }
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    interval_tree_remove(&items[i].node, &root);
+    items[i].present = false;
+    if (i % 100 == 0) {
+      check_tree(&root);
+    }
+  }
+  check_tree(&root);
+
+  for (size_t q = 0; q < 200; ++q) {
+    unsigned long start = test_rand(&state) % MAX_POINT;
+    check_query(&root, start, start + test_rand(&state) % 200);
+  }
+  check_query(&root, 0, ~0UL);
+}
+
+static void test_stab(void) {
+  struct rb_root root = RB_ROOT;
+  struct interval_tree_node *pos;
+  size_t found = 0;
+
+  // Nested intervals [i, 100 - i] all contain 50
+  for (size_t i = 0; i < 50; ++i) {
+    items[i].node.start = i;
+    items[i].node.last = 100 - i;
+    interval_tree_insert(&items[i].node, &root);
+  }
+  interval_tree_for_each_stab(pos, &root, 50) {
+    found++;
+  }
+  check(found == 50);
+
+  found = 0;
+  interval_tree_for_each_stab(pos, &root, 100) {
+    check(pos->start == 0);
+    found++;
+  }
+  check(found == 1);
+
+  check(interval_tree_iter_first(&root, 101, 200) == NULL);
+}
+
+int main(void) {
+  run_test(test_insert_remove);
+  run_test(test_stab);
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "list.h"
+#include "test.h"
+
+struct item {
+  int value;
+  struct list_head list;
+};
+
+static void test_add_del(void) {
+  struct item items[4];
+  struct item *pos;
+  LIST_HEAD(head);
+  int expected = 0;
+
+  check(list_empty(&head));
+  for (int i = 0; i < 4; ++i) {
+    items[i].value = i;
+    list_add_tail(&items[i].list, &head);
+  }
+  check(list_length(&head) == 4);
+  check(list_first_entry(&head, struct item, list) == &items[0]);
+  check(list_is_last(&items[3].list, &head));
+
+  list_for_each_entry(pos, &head, list) {
+    check(pos->value == expected++);
+  }
+
+  list_del(&items[1].list);
+  list_del_init(&items[3].list);
+  check(list_empty(&items[3].list));
+  check(list_length(&head) == 2);
+  check(list_next_entry(&items[0], struct item, list) == &items[2]);
+}
+
+static void test_move_splice(void) {
+  struct item items[6];
+  LIST_HEAD(a);
+  LIST_HEAD(b);
+  struct item *pos, *n;
+  int expected = 0;
+
+  for (int i = 0; i < 6; ++i) {
+    items[i].value = i;
+    list_add_tail(&items[i].list, i < 3 ? &a : &b);
+  }
+
+  list_splice_tail_init(&b, &a);
+  check(list_empty(&b));
+  check(list_length(&a) == 6);
+  list_for_each_entry(pos, &a, list) {
+    check(pos->value == expected++);
+  }
+
+  list_move_tail(&items[0].list, &a);
+  check(list_first_entry(&a, struct item, list) == &items[1]);
+  check(list_is_last(&items[0].list, &a));
+
+  list_for_each_entry_safe(pos, n, &a, list) {
+    list_del(&pos->list);
+  }
+  check(list_empty(&a));
+}
+
+int main(void) {
+  run_test(test_add_del);
+  run_test(test_move_splice);
+  return 0;
+}
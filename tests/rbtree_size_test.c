@@ -0,0 +1,146 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rbtree_size.h"
+#include "test.h"
+
+#include <stdbool.h>
+
+#define NUM_ITEMS 2000
+
+#define CMP(a, b) (((a) < (b)) - ((a) > (b)))
+
+struct item {
+  unsigned long key;
+  bool present;
+  struct rb_size_node node;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check red black properties and the size kept in every node.
+ *
+ * @return black height of the subtree
+ */
+static int check_subtree(struct rb_node *rb, const struct rb_node *parent) {
+  int lh, rh;
+
+  if (!rb) {
+    return 1;
+  }
+  check(rb_parent(rb) == parent);
+  check(rb_is_black(rb) || !rb->rb_left || rb_is_black(rb->rb_left));
+  check(rb_is_black(rb) || !rb->rb_right || rb_is_black(rb->rb_right));
+  check(rb_size_of(rb) == rb_size_of(rb->rb_left) + rb_size_of(rb->rb_right) + 1);
+
+  lh = check_subtree(rb->rb_left, rb);
+  rh = check_subtree(rb->rb_right, rb);
+  check(lh == rh);
+
+  return lh + rb_is_black(rb);
+}
+
+/**
+ * Check the tree and that select and rank agree with the present items, which
+ * are sorted by key.
+ */
+static void check_tree(struct rb_root *root) {
+  size_t k = 0;
+
+  check(!root->rb_node || rb_is_black(root->rb_node));
+  check_subtree(root->rb_node, NULL);
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct item *it = &items[i];
+    struct rb_size_node *node;
+
+    if (!it->present) {
+      continue;
+    }
+    node = rb_select(root, k);
+    check(node == &it->node);
+    check(rb_rank(node) == k);
+    k++;
+  }
+  check(rb_size_count(root) == k);
+  check(rb_select(root, k) == NULL);
+}
+
+/**
+ * Compare range counts with a linear scan.
+ */
+static void check_range(struct rb_root *root, unsigned long lo, unsigned long hi) {
+  size_t expected = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    expected += items[i].present && items[i].key >= lo && items[i].key <= hi;
+  }
+  check(rb_count_range(root, struct item, node, key, lo, hi, CMP) == expected);
+}
+
+static void test_select_rank(void) {
+  struct rb_root root = RB_ROOT;
+  uint64_t state = 1;
+  size_t order[NUM_ITEMS];
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = 2 * i;
+    items[i].present = false;
+    order[i] = i;
+  }
+  for (size_t i = NUM_ITEMS - 1; i > 0; --i) {
+    size_t j = test_rand(&state) % (i + 1), tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct item *it = &items[order[i]];
+
+    rb_size_insert(&root, struct item, node, key, &it->node, CMP);
+    it->present = true;
+    if (i % 250 == 0) {
+      check_tree(&root);
+    }
+  }
+  check_tree(&root);
+
+  for (size_t i = 0; i < NUM_ITEMS; i += 2) {
+    struct item *it = &items[order[i]];
+
+    rb_size_erase(&it->node, &root);
+    it->present = false;
+    if (i % 250 == 0) {
+      check_tree(&root);
+    }
+  }
+  check_tree(&root);
+
+  for (size_t q = 0; q < 500; ++q) {
+    unsigned long lo = test_rand(&state) % (2 * NUM_ITEMS + 2);
+    check_range(&root, lo, lo + test_rand(&state) % 300);
+  }
+  check_range(&root, 0, ~0UL);
+  check_range(&root, 11, 11);
+  check_range(&root, 7, 3);
+}
+
+int main(void) {
+  run_test(test_select_rank);
+  return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rbtree.h"
+#include "test.h"
+
+#define NUM_ITEMS 1000
+
+#define CMP(a, b) (((a) < (b)) - ((a) > (b)))
+
+struct item {
+  unsigned long key;
+  struct rb_node node;
+};
+
+static struct item items[NUM_ITEMS];
+static struct rb_node *nodes[NUM_ITEMS];
+
+/**
+ * Check red black properties of a subtree.
+ *
+ * @return black height of the subtree
+ */
+static int check_subtree(const struct rb_node *rb, const struct rb_node *parent) {
+  int lh, rh;
+
+  if (!rb) {
+    return 1;
+  }
+  check(rb_parent(rb) == parent);
+  check(rb_is_black(rb) || !rb->rb_left || rb_is_black(rb->rb_left));
+  check(rb_is_black(rb) || !rb->rb_right || rb_is_black(rb->rb_right));
+
+  lh = check_subtree(rb->rb_left, rb);
+  rh = check_subtree(rb->rb_right, rb);
+  check(lh == rh);
+
+  return lh + rb_is_black(rb);
+}
+
+/**
+ * Check that the tree is valid and holds exactly items [first, last) in order.
+ */
+static void check_tree(struct rb_root *root, size_t first, size_t last) {
+  struct rb_node *pos;
+  size_t i = first;
+
+  check(!root->rb_node || rb_is_black(root->rb_node));
+  check_subtree(root->rb_node, NULL);
+
+  rb_for_each(pos, root) {
+    check(i < last && pos == &items[i].node);
+    i++;
+  }
+  check(i == last);
+}
+
+static void test_build_sorted(void) {
+  struct rb_root root = RB_ROOT;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    nodes[i] = &items[i].node;
+  }
+
+  // Every size, whether or not its deepest level is complete
+  for (size_t n = 0; n <= 300; ++n) {
+    rb_build_sorted(&root, nodes, n);
+    check_tree(&root, 0, n);
+  }
+  rb_build_sorted(&root, nodes + 7, NUM_ITEMS - 7);
+  check_tree(&root, 7, NUM_ITEMS);
+
+  // The tree is a regular red black tree afterwards
+  for (size_t i = 7; i < NUM_ITEMS; i += 3) {
+    rb_erase(&items[i].node, &root);
+  }
+  for (size_t i = 7; i < NUM_ITEMS; i += 3) {
+    rb_insert(&root, struct item, node, key, &items[i].node, CMP);
+  }
+  check_tree(&root, 7, NUM_ITEMS);
+}
+
+/**
+ * Build a tree of items [first, last) by insertion, so that it has red nodes
+ * in different places than a tree built from sorted nodes.
+ */
+static void insert_range(struct rb_root *root, size_t first, size_t last, uint64_t *state) {
+  *root = RB_ROOT;
+  for (size_t n = last - first; n > 0; --n) {
+    // Insert in random order by starting from a random item each time
+    size_t i = first + test_rand(state) % (last - first);
+
+    while (!RB_EMPTY_NODE(&items[i].node)) {
+      i = i + 1 < last ? i + 1 : first;
+    }
+    rb_insert(root, struct item, node, key, &items[i].node, CMP);
+  }
+}
+
+static void test_join(void) {
+  struct rb_root left, right;
+  uint64_t state = 1;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+  }
+
+  // Trees of very different heights on either side
+  for (size_t split = 0; split < NUM_ITEMS; split += 37) {
+    for (size_t i = 0; i < NUM_ITEMS; ++i) {
+      RB_CLEAR_NODE(&items[i].node);
+    }
+    insert_range(&left, 0, split, &state);
+    insert_range(&right, split + 1, NUM_ITEMS, &state);
+    RB_CLEAR_NODE(&items[split].node);
+
+    rb_join(&left, &items[split].node, &right);
+    check(right.rb_node == NULL);
+    check_tree(&left, 0, NUM_ITEMS);
+  }
+}
+
+static void test_split(void) {
+  struct rb_root root, right;
+  uint64_t state = 1;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = 2 * i;
+  }
+
+  for (size_t split = 0; split <= NUM_ITEMS; split += 29) {
+    for (size_t i = 0; i < NUM_ITEMS; ++i) {
+      RB_CLEAR_NODE(&items[i].node);
+    }
+    insert_range(&root, 0, NUM_ITEMS, &state);
+
+    rb_split_at(&root, split < NUM_ITEMS ? &items[split].node : NULL, &right);
+    check_tree(&root, 0, split);
+    check_tree(&right, split, NUM_ITEMS);
+
+    // Joining the halves back gives the whole tree again
+    if (split < NUM_ITEMS) {
+      struct rb_node *pivot = &items[split].node;
+
+      rb_erase(pivot, &right);
+      rb_join(&root, pivot, &right);
+      check_tree(&root, 0, NUM_ITEMS);
+    }
+  }
+
+  // Split at a key between items, before all and after all of them
+  for (unsigned long key = 0; key <= 2 * NUM_ITEMS; key += 101) {
+    size_t split = (key + 1) / 2;
+
+    rb_build_sorted(&root, nodes, NUM_ITEMS);
+    rb_split(&root, struct item, node, key, key, CMP, &right);
+    check_tree(&root, 0, split);
+    check_tree(&right, split, NUM_ITEMS);
+  }
+}
+
+/**
+ * Check that the cached first and last nodes match those found by walking.
+ */
+static void check_cached(struct rb_root_cached *root) {
+  check(rb_first_cached(root) == rb_first(&root->rb_root));
+  check(rb_last_cached(root) == rb_last(&root->rb_root));
+  check_subtree(root->rb_root.rb_node, NULL);
+}
+
+static void test_cached(void) {
+  struct rb_root_cached root = RB_ROOT_CACHED;
+  struct rb_node *rb;
+  bool present[NUM_ITEMS] = { false };
+  struct item dup;
+  uint64_t state = 1;
+  size_t count = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+  }
+  check_cached(&root);
+
+  // Random inserts, through the macro and by linking nodes directly
+  for (size_t n = 0; n < NUM_ITEMS / 2; ++n) {
+    size_t i = test_rand(&state) % NUM_ITEMS;
+
+    if (present[i]) {
+      // A key already in the tree is not inserted again
+      dup.key = i;
+      RB_CLEAR_NODE(&dup.node);
+      rb_insert_cached(&root, struct item, node, key, &dup.node, CMP);
+      check(RB_EMPTY_NODE(&dup.node));
+    } else if (n % 2) {
+      rb_insert_cached(&root, struct item, node, key, &items[i].node, CMP);
+      present[i] = true;
+      count++;
+    } else {
+      struct rb_node **link = &root.rb_root.rb_node, *parent = NULL;
+
+      while (*link) {
+        parent = *link;
+        link = rb_entry(parent, struct item, node)->key > i ? &parent->rb_left : &parent->rb_right;
+      }
+      rb_link_node(&items[i].node, parent, link);
+      rb_insert_color_cached(&items[i].node, &root);
+      present[i] = true;
+      count++;
+    }
+    check_cached(&root);
+  }
+
+  // New first and last nodes
+  for (size_t i = 0; i < NUM_ITEMS; i += NUM_ITEMS - 1) {
+    if (!present[i]) {
+      rb_insert_cached(&root, struct item, node, key, &items[i].node, CMP);
+      present[i] = true;
+      count++;
+    }
+    check_cached(&root);
+  }
+  check(rb_first_cached(&root) == &items[0].node);
+  check(rb_last_cached(&root) == &items[NUM_ITEMS - 1].node);
+
+  // Erase the first, the last and inner nodes in turn
+  for (size_t n = 0; n < count / 2; ++n) {
+    switch (n % 3) {
+    case 0:
+      rb = rb_first_cached(&root);
+      break;
+    case 1:
+      rb = rb_last_cached(&root);
+      break;
+    default:
+      rb = rb_next(rb_first_cached(&root));
+      break;
+    }
+    present[rb_entry(rb, struct item, node)->key] = false;
+    rb_erase_cached(rb, &root);
+    check_cached(&root);
+  }
+  count -= count / 2;
+
+  // Pop nodes in order until the tree is empty
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    if (present[i]) {
+      check(rb_pop_first_cached(&root) == &items[i].node);
+      check_cached(&root);
+      count--;
+    }
+  }
+  check(count == 0);
+  check(RB_EMPTY_ROOT(&root.rb_root));
+  check(rb_first_cached(&root) == NULL && rb_last_cached(&root) == NULL);
+  check(rb_pop_first_cached(&root) == NULL);
+}
+
+int main(void) {
+  run_test(test_build_sorted);
+  run_test(test_join);
+  run_test(test_split);
+  run_test(test_cached);
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "robin_htable.h"
+#include "test.h"
+
+#define NUM_ITEMS 20000
+
+struct item {
+  uint64_t key;
+  bool present;
+  struct robin_htable_entry entry;
+};
+
+static struct item items[NUM_ITEMS];
+
+/**
+ * Check that exactly the present items are found and that every slot holds
+ * its distance from the home slot, with no gap between an entry and its home.
+ */
+static void check_contents(const struct robin_htable *table) {
+  size_t mask = table->size - 1, count = 0, visited = 0;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    struct robin_htable_entry *e = robin_htable_find(table, &items[i].key, sizeof(uint64_t));
+    check(e == (items[i].present ? &items[i].entry : NULL));
+    count += items[i].present;
+  }
+  check(table->count == count);
+
+  for (size_t i = 0; i < table->size; ++i) {
+    const struct robin_slot *s = &table->slots[i];
+
+    if (s->dist) {
+      check(s->hash == s->entry->hash);
+      check(s->dist == ((i - (s->hash & mask)) & mask) + 1);
+      // Backward shift leaves no empty slot between an entry and its home
+      check(s->dist == 1 || table->slots[(i - 1) & mask].dist >= s->dist - 1);
+      check(container_of(s->entry, struct item, entry)->present);
+      visited++;
+    }
+  }
+  check(visited == count);
+}
+
+static void test_grow(void) {
+  struct robin_htable table;
+
+  robin_htable_init(&table);
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i * 0x9e3779b97f4a7c15ULL;
+    items[i].present = true;
+    check(robin_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0);
+    check(table.count * 16 <= table.size * ROBIN_HTABLE_MAX_LOAD);
+  }
+  check_contents(&table);
+
+  robin_htable_destroy(&table);
+}
+
+static void test_backward_shift(void) {
+  struct robin_htable table;
+  uint64_t state = 1;
+  size_t size;
+
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    items[i].key = i;
+    items[i].present = false;
+  }
+
+  // Keep the table near its maximum load, so that removals shift long runs
+  robin_htable_init_n(&table, 1024);
+  size = table.size;
+  for (size_t i = 0; i < 900; ++i) {
+    check(robin_htable_add(&table, &items[i].entry, &items[i].key, sizeof(uint64_t)) == 0);
+    items[i].present = true;
+  }
+
+  for (size_t op = 0; op < 20 * NUM_ITEMS; ++op) {
+    struct item *it = &items[test_rand(&state) % 1800];
+
+    if (it->present) {
+      if (op & 1) {
+        check(robin_htable_del_key(&table, &it->key, sizeof(uint64_t)) == &it->entry);
+      } else {
+        check(robin_htable_del_entry(&table, &it->entry) == &it->entry);
+      }
+      it->present = false;
+    } else if (table.count < 900) {
+      check(robin_htable_add(&table, &it->entry, &it->key, sizeof(uint64_t)) == 0);
+      it->present = true;
+    }
+    if (op % 10000 == 0) {
+      check_contents(&table);
+    }
+  }
+  check(table.size == size);
+  check_contents(&table);
+
+  robin_htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_grow);
+  run_test(test_backward_shift);
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// libkern itself is built without counting lookups, the table layout must
+// not depend on it
+#define HTABLE_STATS
+
+#include "sharded_htable.h"
+#include "test.h"
+
+#define NUM_SHARDS 4
+#define NUM_PARTS 8
+#define NUM_KEYS 5000
+
+struct item {
+  uint64_t key;
+  size_t count;
+  struct htable_entry entry;
+};
+
+static struct item items[NUM_SHARDS][NUM_KEYS];
+
+static void merge_count(struct htable_entry *dst, struct htable_entry *src, void *arg) {
+  hash_entry(dst, struct item, entry)->count += hash_entry(src, struct item, entry)->count;
+  (*(size_t *)arg)++;
+}
+
+static void test_merge(void) {
+  struct sharded_htable table = { 0 };
+  struct htable_stats stats;
+  size_t folded = 0;
+
+  check(sharded_htable_init(&table, NUM_SHARDS, NUM_PARTS, 0, 0) == 0);
+  for (size_t i = 0; i < NUM_SHARDS; ++i) {
+    // Shard i holds the keys which are multiples of i + 1
+    for (size_t j = 0; j < NUM_KEYS; ++j) {
+      items[i][j].key = j * (i + 1);
+      items[i][j].count = 1;
+      htable_add(sharded_htable_shard(&table, i), &items[i][j].entry, &items[i][j].key, sizeof(uint64_t));
+    }
+  }
+
+  check(sharded_htable_merge(&table, 3, merge_count, &folded) == 0);
+  for (size_t i = 0; i < NUM_SHARDS; ++i) {
+    check(sharded_htable_shard(&table, i)->count == 0);
+  }
+  check(sharded_htable_count(&table) + folded == NUM_SHARDS * NUM_KEYS);
+
+  for (uint64_t key = 0; key < NUM_SHARDS * NUM_KEYS; ++key) {
+    struct htable_entry *e = sharded_htable_find(&table, &key, sizeof(uint64_t));
+    size_t count = 0;
+
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+      count += key % (i + 1) == 0 && key / (i + 1) < NUM_KEYS;
+    }
+    check(count ? e && hash_entry(e, struct item, entry)->count == count : e == NULL);
+  }
+
+  htable_stats(&table.parts[0], &stats);
+  check(stats.lookups > 0);
+
+  sharded_htable_destroy(&table);
+}
+
+int main(void) {
+  run_test(test_merge);
+  return 0;
+}
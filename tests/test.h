@@ -0,0 +1,70 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Minimal unit test support.
+ *
+ * Each test program calls its test functions from main() through
+ * run_test(). A failed check reports its location and exits with failure
+ * status, independently of NDEBUG, so that the automake test driver marks
+ * the program as failed.
+ */
+
+/**
+ * Fail the running test unless condition holds.
+ *
+ * @param cond condition to check
+ */
+#define check(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(EXIT_FAILURE); \
+    } \
+  } while (0)
+
+/**
+ * Run a test function, reporting its name.
+ *
+ * @param fn test function taking no arguments
+ */
+#define run_test(fn) do { \
+    fn(); \
+    printf("ok - %s\n", #fn); \
+  } while (0)
+
+/**
+ * Pseudo-random number generator (xorshift64*), deterministic across runs.
+ *
+ * @param state generator state, must not be zero
+ */
+static inline uint64_t test_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+#endif // TEST_H_